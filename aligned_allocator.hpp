@@ -0,0 +1,47 @@
+#ifndef STRATEGY_ALIGNED_ALLOCATOR_H
+#define STRATEGY_ALIGNED_ALLOCATOR_H
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/*
+AlignedAllocator
+	Description
+		Minimal std::allocator replacement that returns memory aligned to Alignment bytes
+		(Alignment must be a power of two and at least alignof(void*)).
+		Used for buffers that are streamed through SIMD loads, e.g. std::vector<double,AlignedAllocator<double,32>>.
+*/
+template <typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+	template <typename U> struct rebind { typedef AlignedAllocator<U,Alignment> other; };
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U,Alignment>&) {}
+
+	T* allocate(size_t n)
+	{
+		if(n == 0) { return nullptr; }
+		if(n > static_cast<size_t>(-1)/sizeof(T)) { throw std::bad_alloc(); }
+		// Over-allocate and store the pointer returned by malloc right before the aligned block
+		void* raw = std::malloc(n*sizeof(T) + Alignment + sizeof(void*));
+		if(raw == nullptr) { throw std::bad_alloc(); }
+		size_t addr = reinterpret_cast<size_t>(raw) + sizeof(void*);
+		addr = (addr + Alignment - 1) & ~(Alignment - 1);
+		reinterpret_cast<void**>(addr)[-1] = raw;
+		return reinterpret_cast<T*>(addr);
+	}
+	void deallocate(T* p, size_t)
+	{
+		if(p != nullptr) { std::free(reinterpret_cast<void**>(p)[-1]); }
+	}
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T,A>&, const AlignedAllocator<U,A>&) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T,A>&, const AlignedAllocator<U,A>&) { return false; }
+
+#endif
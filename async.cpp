@@ -0,0 +1,79 @@
+#include "wfc.hpp"
+
+GenerationHandle& GenerationHandle::operator=(GenerationHandle&& other)
+{
+	if(this != &other)
+	{
+		stop();
+		result = std::move(other.result);
+		token = other.token;
+		thread = std::move(other.thread);
+	}
+	return *this;
+}
+
+void GenerationHandle::stop()
+{
+	if(!thread.joinable()) { return; }
+	token.cancel(); // No-op if the map is done already
+	thread.join();
+}
+
+GenerationHandle WFC::generate_async(size_t dim_x, size_t dim_y, uint64_t seed, AsyncOptions async_options)
+{
+	// The promise is shared with the thread because C++11 lambdas cannot capture by move
+	std::shared_ptr<std::promise<StringMap>> promise = std::make_shared<std::promise<StringMap>>();
+	std::future<StringMap> result = promise->get_future();
+	CancellationToken handle_token;
+	std::shared_ptr<const WFCModel> shared_model = get_shared_model();
+	WFCOptions solver_options = get_options();
+	std::thread thread([=]()
+	{
+		try
+		{
+			WFCSolver solver(shared_model,solver_options);
+			bool report = (bool)async_options.on_progress;
+			size_t batch_cells = std::max<size_t>(async_options.progress_cells,1);
+			solver.log_collapses(report);
+			solver.begin_map(dim_x,dim_y,seed,async_options.fixed);
+			GenerationProgress progress;
+			progress.total = dim_x*dim_y;
+			std::vector<CellUpdate> taken;
+			std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+			bool done = false;
+			while(!done)
+			{
+				if(handle_token.cancelled() || async_options.cancel.cancelled()) { throw generation_cancelled(); }
+				// Steps end after a batch of cells, so batches are exact, and after a millisecond, for the cancel check
+				size_t max_collapses = report ? batch_cells - progress.cells.size() : std::numeric_limits<size_t>::max();
+				done = solver.step_map(std::chrono::milliseconds(1),max_collapses);
+				if(!report) { continue; }
+				if(solver.get_attempt() != progress.attempt)
+				{
+					// Restarted: the cells not delivered yet belong to the attempt that was given up
+					progress.cells.clear();
+					progress.attempt = solver.get_attempt();
+				}
+				solver.take_collapsed(taken);
+				progress.cells.insert(progress.cells.end(),taken.begin(),taken.end());
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if(done || progress.cells.size() >= batch_cells || now - last_report >= async_options.progress_interval)
+				{
+					progress.collapsed = solver.collapsed_cells();
+					progress.finished = done;
+					async_options.on_progress(progress);
+					progress.cells.clear();
+					last_report = now;
+				}
+			}
+			StringMap map(0,0);
+			solver.finish_map(map);
+			promise->set_value(std::move(map));
+		}
+		catch(...)
+		{
+			promise->set_exception(std::current_exception());
+		}
+	});
+	return GenerationHandle(std::move(result),handle_token,std::move(thread));
+}
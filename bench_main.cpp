@@ -0,0 +1,350 @@
+#include "bench_registry.hpp"
+#include "benchmark.hpp"
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+/*
+* wfc_bench: the benchmark suite of the generator (see bench_registry.hpp for the command line).
+*	learn/<sample>[/overlapping3]: learning a model from the sample, items = input cells
+*	solve/<sample>/<mode>: one 64x64 map, items = collapsed cells, with the propagation cost per collapse
+*	generate/<sample>/<mode>/<dim>: one dim x dim map, items = cells (up to 512x512, less for large tilesets)
+*	regenerate/<sample>/<mode>/<size>: rerolls a size x size area of a 512x512 map, items = cells of the area
+*	reuse/<sample>/<mode>/<dim>: generate_map_into the same StringMap, items = cells, with the heap allocations per map
+*		after the first one. Fails if there are any
+*	order/<sample>/<order>/<mode>/<dim>: one dim x dim map per CollapseOrder, items = cells, with the contradictions per
+*		map and the neighbouring cells per map whose tiles were never neighbours in the sample
+*	chunks/<sample>/<size>: 4x4 chunks of a ChunkWorld per world seed, items = cells. Fails if two neighbouring cells
+*		anywhere in the 4x4 chunks (including across chunk borders and corners) were never neighbours in the sample
+*	parallel/<sample>/<region_size>: generate_map_parallel of one 128x128 map on all hardware threads, items = cells.
+*		Fails like chunks/ if the regions do not fit together
+* The samples are the input maps in Maps/ (input_map_3 is a copy of input_map, input_map_4 is not separated by ';') and synthetic tilesets of 8, 32 and 128 tile types (synthetic_sample).
+*/
+
+#ifndef WFC_SOURCE_DIR
+#define WFC_SOURCE_DIR "."
+#endif
+
+// Every heap allocation of the process is counted, for the allocations_per_map counters. All the replaceable
+// allocation and deallocation functions are replaced together, so that every new is paired with a matching delete.
+static std::atomic<size_t> n_allocations(0);
+
+static void* counted_malloc(size_t size)
+{
+	n_allocations.fetch_add(1,std::memory_order_relaxed);
+	return std::malloc(size > 0 ? size : 1);
+}
+
+static void* counted_malloc_or_throw(size_t size)
+{
+	void* p = counted_malloc(size);
+	if(p == nullptr) { throw std::bad_alloc(); }
+	return p;
+}
+
+void* operator new(size_t size) { return counted_malloc_or_throw(size); }
+void* operator new[](size_t size) { return counted_malloc_or_throw(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+#ifdef __cpp_aligned_new
+// Over-aligned types (C++17 and later)
+static void* counted_aligned_malloc(size_t size, std::align_val_t alignment)
+{
+	n_allocations.fetch_add(1,std::memory_order_relaxed);
+	void* p = nullptr;
+	size_t align = std::max((size_t)alignment,sizeof(void*));
+	if(posix_memalign(&p,align,size > 0 ? size : 1) != 0) { return nullptr; }
+	return p;
+}
+
+static void* counted_aligned_malloc_or_throw(size_t size, std::align_val_t alignment)
+{
+	void* p = counted_aligned_malloc(size,alignment);
+	if(p == nullptr) { throw std::bad_alloc(); }
+	return p;
+}
+
+void* operator new(size_t size, std::align_val_t alignment) { return counted_aligned_malloc_or_throw(size,alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_aligned_malloc_or_throw(size,alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return counted_aligned_malloc(size,alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return counted_aligned_malloc(size,alignment); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
+
+namespace
+{
+	struct Sample
+	{
+		std::string name;
+		std::string filename;
+		bool overlapping; // Also benchmark learning the overlapping model
+		size_t max_dim; // Largest map generated from it
+	};
+
+	const char* mode_name(SolverMode mode) { return mode == SolverMode::bitset ? "bitset" : "probabilistic"; }
+
+	const char* precision_name(WeightPrecision precision) { return precision == WeightPrecision::float32 ? "float32" : "float64"; }
+
+	const char* order_name(CollapseOrder order)
+	{
+		static const char* names[] = {"entropy","scanline","hilbert"};
+		return names[(int)order];
+	}
+
+	void register_learn(const Sample& sample)
+	{
+		register_benchmark("learn/" + sample.name,[sample](BenchState& state) {
+			size_t cells = 0;
+			while(state.keep_running())
+			{
+				WFCModel model(sample.filename);
+				cells += model.get_input().get_width()*model.get_input().get_height();
+			}
+			state.set_items_processed(cells);
+		});
+		if(!sample.overlapping) { return; }
+		register_benchmark("learn/" + sample.name + "/overlapping3",[sample](BenchState& state) {
+			ModelOptions model_options;
+			model_options.learning = LearningMode::overlapping;
+			model_options.pattern_size = 3;
+			model_options.symmetry = true;
+			size_t cells = 0, patterns = 0;
+			while(state.keep_running())
+			{
+				WFCModel model(sample.filename,model_options);
+				cells += model.get_input().get_width()*model.get_input().get_height();
+				patterns = model.get_n_patterns();
+			}
+			state.set_items_processed(cells);
+			state.counters["patterns"] = patterns;
+		});
+	}
+
+	void register_solve(const Sample& sample, SolverMode mode)
+	{
+		register_benchmark("solve/" + sample.name + "/" + mode_name(mode),[sample,mode](BenchState& state) {
+			WFCOptions options;
+			options.mode = mode;
+			WFC wfc(sample.filename,options);
+			PropagationStats total;
+			uint64_t seed = 0;
+			while(state.keep_running())
+			{
+				wfc.generate_map(64,64,seed++);
+				const PropagationStats& stats = wfc.get_propagation_stats();
+				total.collapses += stats.collapses;
+				total.steps += stats.steps;
+				total.contradictions += stats.contradictions;
+			}
+			state.set_items_processed(total.collapses);
+			state.counters["ns_per_collapse"] = total.collapses > 0 ? state.real_seconds()*1e9/total.collapses : 0;
+			state.counters["ns_per_propagation_step"] = total.steps > 0 ? state.real_seconds()*1e9/total.steps : 0;
+			state.counters["steps_per_collapse"] = total.steps_per_collapse();
+			state.counters["contradictions_per_map"] = (double)total.contradictions/state.iterations();
+			state.counters["tile_types"] = wfc.get_model().get_types().size();
+		});
+	}
+
+	void register_generate(const Sample& sample, SolverMode mode, size_t dim)
+	{
+		register_benchmark("generate/" + sample.name + "/" + mode_name(mode) + "/" + std::to_string(dim),[sample,mode,dim](BenchState& state) {
+			WFCOptions options;
+			options.mode = mode;
+			WFC wfc(sample.filename,options);
+			uint64_t seed = 0;
+			while(state.keep_running()) { wfc.generate_map(dim,dim,seed++); }
+			state.set_items_processed((double)state.iterations()*dim*dim);
+		});
+	}
+
+	void register_precision(const Sample& sample, WeightPrecision precision, size_t dim)
+	{
+		register_benchmark("precision/" + sample.name + "/" + precision_name(precision) + "/" + std::to_string(dim),[sample,precision,dim](BenchState& state) {
+			WFCOptions options;
+			options.precision = precision;
+			WFC wfc(sample.filename,options);
+			StringMap map(0,0);
+			size_t contradictions = 0;
+			uint64_t seed = 0;
+			while(state.keep_running())
+			{
+				wfc.generate_map_into(map,dim,dim,seed++);
+				contradictions += wfc.get_propagation_stats().contradictions;
+			}
+			state.set_items_processed((double)state.iterations()*dim*dim);
+			state.counters["contradictions_per_map"] = (double)contradictions/state.iterations();
+		});
+	}
+
+	void register_reuse(const Sample& sample, SolverMode mode, size_t dim)
+	{
+		register_benchmark("reuse/" + sample.name + "/" + mode_name(mode) + "/" + std::to_string(dim),[sample,mode,dim](BenchState& state) {
+			WFCOptions options;
+			options.mode = mode;
+			WFC wfc(sample.filename,options);
+			StringMap map(0,0);
+			wfc.generate_map_into(map,dim,dim,(uint64_t)0); // Sizes the buffers
+			uint64_t seed = 1;
+			size_t allocations = n_allocations.load();
+			while(state.keep_running()) { wfc.generate_map_into(map,dim,dim,seed++); }
+			allocations = n_allocations.load() - allocations;
+			state.counters["allocations_per_map"] = (double)allocations/state.iterations();
+			state.set_items_processed((double)state.iterations()*dim*dim);
+			if(allocations > 0) { state.skip_with_error(std::to_string(allocations) + " heap allocations in " + std::to_string(state.iterations()) + " maps after the first one"); }
+		});
+	}
+
+	void register_order(const Sample& sample, SolverMode mode, CollapseOrder order, size_t dim)
+	{
+		register_benchmark("order/" + sample.name + "/" + order_name(order) + "/" + mode_name(mode) + "/" + std::to_string(dim),[sample,mode,order,dim](BenchState& state) {
+			WFCOptions options;
+			options.mode = mode;
+			options.order = order;
+			WFC wfc(sample.filename,options);
+			StringMap map(0,0);
+			size_t contradictions = 0, violations = 0;
+			uint64_t seed = 0;
+			while(state.keep_running())
+			{
+				wfc.generate_map_into(map,dim,dim,seed++);
+				contradictions += wfc.get_propagation_stats().contradictions;
+				state.pause_timing();
+				violations += count_violations(wfc.get_model(),map);
+				state.resume_timing();
+			}
+			state.set_items_processed((double)state.iterations()*dim*dim);
+			state.counters["contradictions_per_map"] = (double)contradictions/state.iterations();
+			state.counters["violations_per_map"] = (double)violations/state.iterations();
+		});
+	}
+
+	void register_chunks(const Sample& sample, size_t size)
+	{
+		register_benchmark("chunks/" + sample.name + "/" + std::to_string(size),[sample,size](BenchState& state) {
+			std::shared_ptr<const WFCModel> model = std::make_shared<WFCModel>(sample.filename);
+			const size_t n = 4, dim = n*size;
+			size_t violations = 0;
+			uint64_t seed = 0;
+			while(state.keep_running())
+			{
+				ChunkWorld world(model,size,seed++,n*n);
+				for(size_t c = 0; c < n*n; c++) { world.chunk(c % n,c / n); }
+				state.pause_timing();
+				StringMap map(dim,dim,model->get_types());
+				for(size_t y = 0; y < dim; y++)
+				{
+					for(size_t x = 0; x < dim; x++) { map.push_back(world.at(x,y)); }
+				}
+				violations += count_violations(*model,map);
+				state.resume_timing();
+			}
+			state.set_items_processed((double)state.iterations()*n*n*size*size);
+			state.counters["violations_per_map"] = (double)violations/state.iterations();
+			if(violations > 0) { state.skip_with_error(std::to_string(violations) + " adjacency violations in chunks of seeds 0 to " + std::to_string(seed - 1)); }
+		});
+	}
+
+	void register_parallel(const Sample& sample, size_t region_size)
+	{
+		register_benchmark("parallel/" + sample.name + "/" + std::to_string(region_size),[sample,region_size](BenchState& state) {
+			const size_t dim = 128;
+			WFC wfc(sample.filename);
+			size_t violations = 0;
+			uint64_t seed = 0;
+			while(state.keep_running())
+			{
+				StringMap map = wfc.generate_map_parallel(dim,dim,seed++,region_size);
+				state.pause_timing();
+				violations += count_violations(wfc.get_model(),map);
+				state.resume_timing();
+			}
+			state.set_items_processed((double)state.iterations()*dim*dim);
+			state.counters["violations_per_map"] = (double)violations/state.iterations();
+			if(violations > 0) { state.skip_with_error(std::to_string(violations) + " adjacency violations in maps of seeds 0 to " + std::to_string(seed - 1)); }
+		});
+	}
+
+	void register_regenerate(const Sample& sample, SolverMode mode, size_t size)
+	{
+		register_benchmark("regenerate/" + sample.name + "/" + mode_name(mode) + "/" + std::to_string(size),[sample,mode,size](BenchState& state) {
+			const size_t dim = 512;
+			WFCOptions options;
+			options.mode = mode;
+			WFC wfc(sample.filename,options);
+			StringMap map = wfc.generate_map(dim,dim,(uint64_t)0);
+			Xoshiro256 rng(1);
+			while(state.keep_running())
+			{
+				wfc.regenerate(map,rng.below(dim - size + 1),rng.below(dim - size + 1),size,size,rng.next());
+			}
+			state.set_items_processed((double)state.iterations()*size*size);
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	// Keep std::cout for the results (e.g. --benchmark_format=json)
+	set_log_sink(std::make_shared<StreamSink>(std::cerr));
+	std::string maps = std::string(WFC_SOURCE_DIR) + "/Maps/";
+	std::vector<Sample> samples;
+	samples.push_back(Sample{"input_map",maps + "input_map.txt",true,512});
+	samples.push_back(Sample{"input_map_2",maps + "input_map_2.txt",true,512});
+	// Large tilesets, written next to the binary. A collapse costs about n_types times more, so the maps are smaller.
+	for(size_t n_types = 8, max_dim = 512; n_types <= 128; n_types *= 4, max_dim /= 2)
+	{
+		Sample sample{"synthetic_" + std::to_string(n_types),"wfc_bench_synthetic_" + std::to_string(n_types) + ".txt",false,max_dim};
+		synthetic_sample(n_types,std::max((size_t)64,2*n_types)).write_to_file(sample.filename);
+		samples.push_back(sample);
+	}
+	const SolverMode modes[2] = {SolverMode::probabilistic,SolverMode::bitset};
+	for(const Sample& sample : samples) { register_learn(sample); }
+	for(const Sample& sample : samples)
+	{
+		for(SolverMode mode : modes) { register_solve(sample,mode); }
+	}
+	for(const Sample& sample : samples)
+	{
+		for(SolverMode mode : modes)
+		{
+			for(size_t dim = 64; dim <= sample.max_dim; dim *= 2) { register_generate(sample,mode,dim); }
+		}
+	}
+	const WeightPrecision precisions[2] = {WeightPrecision::float64,WeightPrecision::float32};
+	for(const Sample& sample : samples)
+	{
+		for(WeightPrecision precision : precisions) { register_precision(sample,precision,std::min((size_t)256,sample.max_dim)); }
+	}
+	const CollapseOrder orders[3] = {CollapseOrder::entropy,CollapseOrder::scanline,CollapseOrder::hilbert};
+	for(const Sample& sample : samples)
+	{
+		for(CollapseOrder order : orders)
+		{
+			for(SolverMode mode : modes) { register_order(sample,mode,order,std::min((size_t)256,sample.max_dim)); }
+		}
+	}
+	for(size_t s = 0; s < 2; s++)
+	{
+		for(size_t size = 8; size <= 64; size *= 2) { register_chunks(samples[s],size); }
+		for(size_t region_size = 8; region_size <= 32; region_size *= 2) { register_parallel(samples[s],region_size); }
+	}
+	for(SolverMode mode : modes)
+	{
+		for(size_t size = 8; size <= 128; size *= 4) { register_regenerate(samples[0],mode,size); }
+		register_reuse(samples[0],mode,64);
+		register_reuse(samples[0],mode,256);
+	}
+	return run_benchmarks(argc,argv);
+}
@@ -0,0 +1,244 @@
+#include "bench_registry.hpp"
+#include "thread_pool.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <regex>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+	struct Benchmark
+	{
+		std::string name;
+		std::function<void(BenchState&)> function;
+	};
+
+	struct BenchResult
+	{
+		std::string name;
+		size_t iterations;
+		double real_ns; // Per iteration
+		double cpu_ns;
+		double items_per_second;
+		std::string label;
+		std::map<std::string,double> counters;
+		std::string error; // what() of the exception the benchmark threw, or the message of skip_with_error
+	};
+
+	std::vector<Benchmark>& registry()
+	{
+		static std::vector<Benchmark> benchmarks;
+		return benchmarks;
+	}
+
+	std::string json_string(const std::string& s)
+	{
+		std::string out = "\"";
+		for(char c : s)
+		{
+			if(c == '"' || c == '\\') { out += '\\'; out += c; }
+			else if((unsigned char)c < 0x20) { char buf[8]; std::snprintf(buf,sizeof(buf),"\\u%04x",c); out += buf; }
+			else { out += c; }
+		}
+		return out + "\"";
+	}
+
+	// Runs benchmark with 1, then more iterations until the timed loop takes at least min_time seconds
+	BenchResult run(const Benchmark& benchmark, double min_time)
+	{
+		size_t iterations = 1;
+		while(true)
+		{
+			BenchState state(iterations);
+			benchmark.function(state);
+			if(!state.get_error().empty())
+			{
+				BenchResult failed = BenchResult();
+				failed.name = benchmark.name;
+				failed.error = state.get_error();
+				return failed;
+			}
+			double seconds = state.real_seconds();
+			if(seconds >= min_time || iterations >= 1000000000)
+			{
+				BenchResult result;
+				result.name = benchmark.name;
+				result.iterations = iterations;
+				result.real_ns = seconds*1e9/iterations;
+				result.cpu_ns = state.cpu_seconds()*1e9/iterations;
+				result.items_per_second = seconds > 0 ? state.items_processed()/seconds : 0;
+				result.label = state.get_label();
+				result.counters = state.counters;
+				return result;
+			}
+			// Aim a bit past min_time, but grow at most 10x per run like Google Benchmark
+			double factor = seconds > 0 ? 1.4*min_time/seconds : 10;
+			size_t next = (size_t)(iterations*std::min(std::max(factor,2.0),10.0));
+			iterations = std::min(next,(size_t)1000000000);
+		}
+	}
+
+	void print_console(const BenchResult& result, size_t name_width)
+	{
+		if(!result.error.empty())
+		{
+			std::cout << std::left << std::setw(name_width) << result.name << "ERROR: " << result.error << std::right << std::endl;
+			return;
+		}
+		std::cout << std::left << std::setw(name_width) << result.name << std::right << std::fixed << std::setprecision(0)
+			<< std::setw(15) << result.real_ns << " ns" << std::setw(15) << result.cpu_ns << " ns" << std::setw(12) << result.iterations;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(4);
+		if(result.items_per_second > 0) { std::cout << " items_per_second=" << result.items_per_second; }
+		for(const std::pair<const std::string,double>& counter : result.counters) { std::cout << " " << counter.first << "=" << counter.second; }
+		if(!result.label.empty()) { std::cout << " " << result.label; }
+		std::cout << std::endl;
+	}
+
+	void write_json(std::ostream& os, const std::vector<BenchResult>& results, const char* executable)
+	{
+		std::time_t now = std::time(nullptr);
+		char date[64];
+		std::strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%S",std::localtime(&now));
+		os << std::setprecision(17);
+		os << "{\n  \"context\": {\n";
+		os << "    \"date\": " << json_string(date) << ",\n";
+		os << "    \"executable\": " << json_string(executable) << ",\n";
+		os << "    \"num_cpus\": " << ThreadPool::hardware_threads() << ",\n";
+#ifdef NDEBUG
+		os << "    \"library_build_type\": \"release\"\n";
+#else
+		os << "    \"library_build_type\": \"debug\"\n";
+#endif
+		os << "  },\n  \"benchmarks\": [";
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult& r = results[i];
+			os << (i == 0 ? "\n" : ",\n") << "    {\n";
+			os << "      \"name\": " << json_string(r.name) << ",\n";
+			os << "      \"run_name\": " << json_string(r.name) << ",\n";
+			os << "      \"run_type\": \"iteration\",\n";
+			if(!r.error.empty())
+			{
+				os << "      \"error_occurred\": true,\n";
+				os << "      \"error_message\": " << json_string(r.error) << "\n    }";
+				continue;
+			}
+			os << "      \"iterations\": " << r.iterations << ",\n";
+			os << "      \"real_time\": " << r.real_ns << ",\n";
+			os << "      \"cpu_time\": " << r.cpu_ns << ",\n";
+			os << "      \"time_unit\": \"ns\"";
+			if(r.items_per_second > 0) { os << ",\n      \"items_per_second\": " << r.items_per_second; }
+			for(const std::pair<const std::string,double>& counter : r.counters) { os << ",\n      " << json_string(counter.first) << ": " << counter.second; }
+			if(!r.label.empty()) { os << ",\n      \"label\": " << json_string(r.label); }
+			os << "\n    }";
+		}
+		os << "\n  ]\n}\n";
+	}
+
+	// Value of --flag=value in arg, or nullptr
+	const char* flag_value(const char* arg, const char* flag)
+	{
+		size_t n = std::string(flag).size();
+		if(std::string(arg).compare(0,n,flag) == 0 && arg[n] == '=') { return arg + n + 1; }
+		return nullptr;
+	}
+}
+
+void register_benchmark(const std::string& name, std::function<void(BenchState&)> benchmark)
+{
+	Benchmark b;
+	b.name = name;
+	b.function = benchmark;
+	registry().push_back(b);
+}
+
+int run_benchmarks(int argc, char** argv)
+{
+	std::string filter = ".", format = "console", out;
+	double min_time = 0.5;
+	bool list = false;
+	for(int i = 1; i < argc; i++)
+	{
+		const char* value;
+		if((value = flag_value(argv[i],"--benchmark_filter"))) { filter = value; }
+		else if((value = flag_value(argv[i],"--benchmark_min_time"))) { min_time = std::atof(value); }
+		else if((value = flag_value(argv[i],"--benchmark_format"))) { format = value; }
+		else if((value = flag_value(argv[i],"--benchmark_out"))) { out = value; }
+		else if(std::string(argv[i]) == "--benchmark_list_tests") { list = true; }
+		else
+		{
+			std::cerr << "Unknown argument " << argv[i] << std::endl;
+			std::cerr << "Usage: " << argv[0] << " [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>] [--benchmark_format=<console|json>] [--benchmark_out=<file>] [--benchmark_list_tests]" << std::endl;
+			return 1;
+		}
+	}
+	if(format != "console" && format != "json")
+	{
+		std::cerr << "Unknown format " << format << std::endl;
+		return 1;
+	}
+	std::regex pattern;
+	try
+	{
+		pattern = std::regex(filter);
+	}
+	catch(std::regex_error& e)
+	{
+		std::cerr << "Invalid filter " << filter << ": " << e.what() << std::endl;
+		return 1;
+	}
+	std::vector<const Benchmark*> selected;
+	size_t name_width = 10;
+	for(const Benchmark& b : registry())
+	{
+		if(!std::regex_search(b.name,pattern)) { continue; }
+		selected.push_back(&b);
+		name_width = std::max(name_width,b.name.size() + 2);
+	}
+	if(list)
+	{
+		for(const Benchmark* b : selected) { std::cout << b->name << std::endl; }
+		return 0;
+	}
+	bool console = format == "console";
+	if(console)
+	{
+		std::cout << std::left << std::setw(name_width) << "Benchmark" << std::right << std::setw(18) << "Time" << std::setw(18) << "CPU" << std::setw(12) << "Iterations" << std::endl;
+	}
+	std::vector<BenchResult> results;
+	bool any_failed = false;
+	for(const Benchmark* b : selected)
+	{
+		try
+		{
+			results.push_back(run(*b,min_time));
+		}
+		catch(std::exception& e)
+		{
+			BenchResult failed = BenchResult();
+			failed.name = b->name;
+			failed.error = e.what();
+			results.push_back(failed);
+		}
+		if(!results.back().error.empty()) { any_failed = true; }
+		if(console) { print_console(results.back(),name_width); }
+	}
+	if(!console) { write_json(std::cout,results,argv[0]); }
+	if(!out.empty())
+	{
+		std::ofstream ofs(out,std::ofstream::out);
+		write_json(ofs,results,argv[0]);
+		if(!ofs)
+		{
+			std::cerr << "Cannot write " << out << std::endl;
+			return 1;
+		}
+	}
+	return any_failed ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+#ifndef STRATEGY_BENCH_REGISTRY_H
+#define STRATEGY_BENCH_REGISTRY_H
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <chrono>
+#include <ctime>
+
+/*
+BenchState
+	Description
+		Passed to every registered benchmark, in the style of Google Benchmark: the benchmark loops while
+		keep_running() returns true and times only that loop, so setup before the loop is not timed. The runner
+		calls the benchmark again with more iterations until one run takes at least the minimum time. Setup
+		inside the loop can be excluded with pause_timing()/resume_timing(). items_processed turns into items per second (e.g. cells/s), and
+		counters are reported as they are (e.g. contradictions per map). A benchmark that checks its results fails with
+		skip_with_error(), which ends the loop and makes run_benchmarks return a non-zero exit code.
+
+	Example use case:
+		register_benchmark("generate/64",[](BenchState& state) {
+			WFC wfc("Maps/input_map.txt");
+			while(state.keep_running()) { wfc.generate_map(64,64); }
+			state.set_items_processed(state.iterations()*64*64);
+		});
+*/
+class BenchState
+{
+public:
+	explicit BenchState(size_t max_iterations) : max_iterations(max_iterations), done(0), paused(false), started(false), items(0), real(0), cpu(0) {}
+	bool keep_running()
+	{
+		if(!started) { started = true; start(); }
+		if(done < max_iterations && error.empty()) { done++; return true; }
+		if(!paused) { stop(); }
+		return false;
+	}
+	void pause_timing() { if(started && !paused) { stop(); paused = true; } }
+	void resume_timing() { if(started && paused) { paused = false; start(); } }
+	size_t iterations() const { return max_iterations; }
+	void set_items_processed(double n) { items = n; }
+	void set_label(const std::string& text) { label = text; }
+	void skip_with_error(const std::string& message) { error = message; }
+
+	double items_processed() const { return items; }
+	double real_seconds() const { return real; }
+	double cpu_seconds() const { return cpu; }
+	const std::string& get_label() const { return label; }
+	const std::string& get_error() const { return error; }
+	std::map<std::string,double> counters;
+private:
+	void start() { real_start = std::chrono::steady_clock::now(); cpu_start = std::clock(); }
+	void stop()
+	{
+		real += std::chrono::duration<double>(std::chrono::steady_clock::now() - real_start).count();
+		cpu += (double)(std::clock() - cpu_start)/CLOCKS_PER_SEC;
+	}
+
+	size_t max_iterations;
+	size_t done;
+	bool paused;
+	bool started;
+	double items;
+	double real;
+	double cpu;
+	std::string label;
+	std::string error;
+	std::chrono::steady_clock::time_point real_start;
+	std::clock_t cpu_start;
+};
+
+/*
+* Adds a benchmark to the registry run by run_benchmarks. Names are paths like "generate/input_map/bitset/256".
+*/
+void register_benchmark(const std::string& name, std::function<void(BenchState&)> benchmark);
+/*
+* Runs the registered benchmarks whose name matches the filter and prints a table to std::cout.
+* Understands the Google Benchmark flags --benchmark_filter=<regex>, --benchmark_min_time=<seconds>,
+* --benchmark_format=<console|json>, --benchmark_out=<file> and --benchmark_list_tests, and writes JSON
+* in the same schema (so e.g. its compare.py can diff two runs). Returns the exit code for main: non-zero if a
+* benchmark threw or called skip_with_error.
+*/
+int run_benchmarks(int argc, char** argv);
+
+#endif
@@ -0,0 +1,432 @@
+#include "benchmark.hpp"
+#include "simd.hpp"
+
+// Reference implementations: the plain loops WFC used before the SIMD kernels
+static void reference_multiply_normalize(const double* probs1, double* probs2, size_t n)
+{
+	double sum = 0;
+	for(size_t i = 0; i < n; i++) { probs2[i] *= probs1[i]; sum += probs2[i]; }
+	for(size_t i = 0; i < n; i++) { probs2[i] = probs2[i]/sum; }
+}
+
+static double reference_entropy(const double* probs, size_t n)
+{
+	double H = 0;
+	for(size_t i = 0; i < n; i++) { if(probs[i] > 0) { H += probs[i]*log2(probs[i]); } }
+	return -H;
+}
+
+// Reference implementation: the line by line parser StringMap used before the single pass over a mapped file
+static std::vector<std::string> reference_import(const std::string& filename, size_t& width, size_t& height)
+{
+	std::vector<std::string> data;
+	std::ifstream istr_row(filename,std::ifstream::in);
+	std::string line, word;
+	width = 0; height = 0;
+	while(std::getline(istr_row,line))
+	{
+		std::stringstream istr_col(line);
+		while(std::getline(istr_col,word,';')) { data.push_back(word); }
+		if(width == 0) { width = data.size(); }
+		height++;
+	}
+	return data;
+}
+
+// Fills rows*n random, normalized probabilities (rows of length stride, padded with zeros)
+static std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> random_rows(size_t rows, size_t n, size_t stride, std::default_random_engine& generator)
+{
+	std::uniform_real_distribution<double> distribution(0.5,1.5);
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> data(rows*stride,0.0);
+	for(size_t r = 0; r < rows; r++)
+	{
+		double sum = 0;
+		for(size_t i = 0; i < n; i++) { data[r*stride + i] = distribution(generator); sum += data[r*stride + i]; }
+		for(size_t i = 0; i < n; i++) { data[r*stride + i] /= sum; }
+	}
+	return data;
+}
+
+StringMap synthetic_sample(size_t n_types, size_t dim)
+{
+	std::vector<std::string> palette;
+	for(size_t i = 0; i < n_types; i++) { palette.push_back("S" + std::to_string(i)); }
+	StringMap sm(dim,dim,palette);
+	// Sum of a few plane waves of random direction, wave length between dim/4 and dim
+	const size_t n_waves = 6;
+	const double pi = 3.14159265358979323846;
+	double kx[n_waves], ky[n_waves], phase[n_waves];
+	Xoshiro256 rng(n_types);
+	for(size_t w = 0; w < n_waves; w++)
+	{
+		double angle = 2*pi*rng.uniform(), k = 2*pi/(dim*(0.25 + 0.75*rng.uniform()));
+		kx[w] = k*cos(angle);
+		ky[w] = k*sin(angle);
+		phase[w] = 2*pi*rng.uniform();
+	}
+	std::vector<double> heights(dim*dim);
+	double low = 1e300, high = -1e300;
+	for(size_t y = 0; y < dim; y++)
+	{
+		for(size_t x = 0; x < dim; x++)
+		{
+			double h = 0;
+			for(size_t w = 0; w < n_waves; w++) { h += cos(kx[w]*x + ky[w]*y + phase[w]); }
+			heights[y*dim + x] = h;
+			low = std::min(low,h);
+			high = std::max(high,h);
+		}
+	}
+	// Stretch to all n_types levels
+	for(double h : heights) { sm.push_back((tile_id)std::min(n_types - 1,(size_t)((h - low)/(high - low)*n_types))); }
+	return sm;
+}
+
+size_t count_violations(const WFCModel& model, const StringMap& map)
+{
+	size_t dim_x = map.get_width(), dim_y = map.get_height(), violations = 0;
+	Grid grid;
+	grid.reset(dim_x,dim_y);
+	for(size_t idx = 0; idx < dim_x*dim_y; idx++)
+	{
+		tile_id tile = map.get_id(idx);
+		uint8_t valid = grid.mask(idx);
+		const int* offsets = grid.offsets(idx);
+		for(unsigned int dir = 0; dir < 8; dir++)
+		{
+			if(!(valid >> dir & 1)) { continue; }
+			tile_id neig = map.get_id(idx + offsets[dir]);
+			if(!(model.adjacency_mask(tile,dir)[neig/64] >> (neig%64) & 1)) { violations++; }
+		}
+	}
+	return violations;
+}
+
+void bench_map_sizes(std::string input_map, size_t min_dim, size_t max_dim, WFCOptions options)
+{
+	WFC wfc(input_map,options);
+	std::cout << (options.mode == SolverMode::bitset ? "bitset" : "probabilistic") << " mode: dim_x x dim_y, cells, seconds, cells/s" << std::endl;
+	for(size_t dim = min_dim; dim <= max_dim; dim *= 2)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		StringMap sm = wfc.generate_map(dim,dim);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		size_t cells = sm.get_width()*sm.get_height();
+		std::cout << dim << "x" << dim << ", " << cells << ", " << elapsed.count() << ", " << cells/elapsed.count() << std::endl;
+	}
+}
+
+void bench_batch(std::string input_map, size_t n_maps, size_t dim, size_t max_threads, WFCOptions options)
+{
+	WFC wfc(input_map,options);
+	std::cout << "batch of " << n_maps << " maps of " << dim << "x" << dim << ": threads, seconds, maps/s, speedup" << std::endl;
+	double single = 0;
+	for(size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<StringMap> maps = wfc.generate_batch(n_maps,dim,dim,(uint64_t)12345,threads);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if(threads == 1) { single = elapsed.count(); }
+		std::cout << threads << ", " << elapsed.count() << ", " << maps.size()/elapsed.count() << ", " << single/elapsed.count() << std::endl;
+	}
+}
+
+void bench_chunks(std::string input_map, size_t chunk_size, size_t n_chunks, int64_t world_size, WFCOptions options)
+{
+	ChunkWorld world(std::make_shared<WFCModel>(input_map),chunk_size,12345,16,options);
+	int64_t n_world_chunks = world_size/(int64_t)chunk_size;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < n_chunks; i++)
+	{
+		int64_t c = (int64_t)i*n_world_chunks/(int64_t)n_chunks;
+		world.chunk(c,c);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	double cells = (double)n_chunks*chunk_size*chunk_size;
+	std::cout << "chunks of " << chunk_size << "x" << chunk_size << ": chunks, seconds, cells/s, resident chunks" << std::endl;
+	std::cout << n_chunks << ", " << elapsed.count() << ", " << cells/elapsed.count() << ", " << world.resident() << std::endl;
+}
+
+void bench_parallel(std::string input_map, size_t dim, size_t region_size, size_t max_threads, WFCOptions options)
+{
+	WFC wfc(input_map,options);
+	double cells = (double)dim*dim;
+	std::cout << "map of " << dim << "x" << dim << " in regions of " << region_size << ": threads, seconds, cells/s, speedup, violations" << std::endl;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	StringMap sm = wfc.generate_map(dim,dim,(uint64_t)12345);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "sequential, " << elapsed.count() << ", " << cells/elapsed.count() << ", -, " << count_violations(wfc.get_model(),sm) << std::endl;
+	double single = 0;
+	for(size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		start = std::chrono::steady_clock::now();
+		sm = wfc.generate_map_parallel(dim,dim,(uint64_t)12345,region_size,threads);
+		elapsed = std::chrono::steady_clock::now() - start;
+		if(threads == 1) { single = elapsed.count(); }
+		// Not timed. Should be as low as for the sequential map: the regions fit together
+		size_t violations = count_violations(wfc.get_model(),sm);
+		std::cout << threads << ", " << elapsed.count() << ", " << cells/elapsed.count() << ", " << single/elapsed.count() << ", " << violations << std::endl;
+	}
+}
+
+// Random dim x dim map of n_types tile types named T0, T1, ... in runs of 4 cells on average
+static StringMap random_map(size_t dim, size_t n_types)
+{
+	std::vector<std::string> palette;
+	for(size_t i = 0; i < n_types; i++) { palette.push_back("T" + std::to_string(i)); }
+	StringMap sm(dim,dim,palette);
+	Xoshiro256 rng(12345);
+	tile_id id = 0;
+	for(size_t i = 0; i < dim*dim; i++)
+	{
+		if(rng.below(4) == 0) { id = rng.below(n_types); }
+		sm.push_back(id);
+	}
+	return sm;
+}
+
+static size_t file_size(const std::string& filename)
+{
+	std::ifstream ifs(filename,std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+	return ifs.tellg();
+}
+
+void bench_import(std::string filename, size_t dim, size_t n_types, size_t n_iterations)
+{
+	random_map(dim,n_types).write_to_file(filename);
+
+	double mapped = 0, reference = 0, megabytes = 0;
+	bool equal = true;
+	for(size_t it = 0; it < n_iterations; it++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		StringMap imported(filename);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		mapped += elapsed.count();
+
+		size_t width, height;
+		start = std::chrono::steady_clock::now();
+		std::vector<std::string> words = reference_import(filename,width,height);
+		elapsed = std::chrono::steady_clock::now() - start;
+		reference += elapsed.count();
+
+		megabytes = 0;
+		for(const std::string& word : words) { megabytes += word.size() + 1; }
+		megabytes /= 1e6;
+		equal = equal && imported.get_width() == width && imported.get_height() == height && imported.get_ids().size() == words.size();
+		for(size_t i = 0; equal && i < words.size(); i++) { equal = imported[i] == words[i]; }
+	}
+	mapped /= n_iterations; reference /= n_iterations;
+	std::cout << "import of " << dim << "x" << dim << " map (" << n_types << " types): parser, megabytes, seconds, MB/s" << std::endl;
+	std::cout << "mapped, " << megabytes << ", " << mapped << ", " << megabytes/mapped << std::endl;
+	std::cout << "getline, " << megabytes << ", " << reference << ", " << megabytes/reference << std::endl;
+	if(!equal) { std::cout << "parsers disagree!" << std::endl; }
+}
+
+void bench_formats(std::string filename, size_t dim, size_t n_types)
+{
+	StringMap sm = random_map(dim,n_types);
+	std::string text_file = filename + ".txt", binary_file = filename + ".wfcm";
+	std::cout << "formats of " << dim << "x" << dim << " map (" << n_types << " types): format, bytes, write seconds, read seconds" << std::endl;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	sm.write_to_file(text_file);
+	std::chrono::duration<double> write = std::chrono::steady_clock::now() - start;
+	start = std::chrono::steady_clock::now();
+	StringMap text(text_file);
+	std::chrono::duration<double> read = std::chrono::steady_clock::now() - start;
+	std::cout << "text, " << file_size(text_file) << ", " << write.count() << ", " << read.count() << std::endl;
+
+	start = std::chrono::steady_clock::now();
+	sm.write_binary(binary_file);
+	write = std::chrono::steady_clock::now() - start;
+	start = std::chrono::steady_clock::now();
+	StringMap binary(binary_file);
+	read = std::chrono::steady_clock::now() - start;
+	std::cout << "binary, " << file_size(binary_file) << ", " << write.count() << ", " << read.count() << std::endl;
+
+	// Random access straight from the mapped file, without decoding the map
+	const size_t n_reads = 1000000;
+	BinaryMapReader reader(binary_file);
+	Xoshiro256 rng(1);
+	size_t mismatches = 0;
+	start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < n_reads; i++)
+	{
+		size_t x = rng.below(dim), y = rng.below(dim);
+		mismatches += reader.at(x,y) != sm.get_id(y*dim + x);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "random cell reads, ns/read: " << 1e9*elapsed.count()/n_reads << std::endl;
+	// The text import numbers the types in order of occurrence, so compare it by name
+	bool equal = mismatches == 0 && binary.get_ids() == sm.get_ids() && text.get_ids().size() == sm.get_ids().size();
+	for(size_t i = 0; equal && i < dim*dim; i++) { equal = text[i] == sm[i]; }
+	if(!equal) { std::cout << "formats disagree!" << std::endl; }
+}
+
+void bench_overlapping(std::string input_map, size_t dim, size_t max_pattern_size, bool symmetry)
+{
+	WFCOptions options;
+	options.mode = SolverMode::bitset;
+	options.contradiction = ContradictionPolicy::backtrack;
+	std::cout << input_map << " " << dim << "x" << dim << ": model, patterns, learn seconds, generate seconds, cells/s, contradictions, backtracks, restarts" << std::endl;
+	for(size_t n = 1; n <= max_pattern_size; n++)
+	{
+		ModelOptions model_options;
+		if(n > 1)
+		{
+			model_options.learning = LearningMode::overlapping;
+			model_options.pattern_size = n;
+			model_options.symmetry = symmetry;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		WFC wfc(input_map,options,model_options);
+		std::chrono::duration<double> learn = std::chrono::steady_clock::now() - start;
+		start = std::chrono::steady_clock::now();
+		wfc.generate_map(dim,dim,(uint64_t)12345);
+		std::chrono::duration<double> generate = std::chrono::steady_clock::now() - start;
+		const PropagationStats& stats = wfc.get_propagation_stats();
+		std::cout << (n > 1 ? "overlapping N=" + std::to_string(n) : std::string("adjacent")) << ", " << wfc.get_model().get_n_patterns() << ", " << learn.count() << ", "
+			<< generate.count() << ", " << dim*dim/generate.count() << ", " << stats.contradictions << ", " << stats.backtracks << ", " << stats.restarts << std::endl;
+	}
+}
+
+void bench_model_cache(std::string input_map, std::string cache_dir, size_t pattern_size, size_t n_iterations)
+{
+	std::cout << input_map << ": model, compiled bytes, learn seconds, save seconds, load seconds, same hash" << std::endl;
+	for(unsigned int overlapping = 0; overlapping < 2; overlapping++)
+	{
+		ModelOptions model_options;
+		if(overlapping)
+		{
+			model_options.learning = LearningMode::overlapping;
+			model_options.pattern_size = pattern_size;
+			model_options.symmetry = true;
+		}
+		std::string filename = cache_dir + "/bench_model_" + std::to_string(overlapping) + ".wfcc";
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t it = 0; it < n_iterations; it++) { WFCModel model(input_map,model_options); }
+		std::chrono::duration<double> learn = std::chrono::steady_clock::now() - start;
+		WFCModel model(input_map,model_options);
+		start = std::chrono::steady_clock::now();
+		model.save(filename);
+		std::chrono::duration<double> save = std::chrono::steady_clock::now() - start;
+		bool same = true;
+		start = std::chrono::steady_clock::now();
+		for(size_t it = 0; it < n_iterations; it++) { same &= WFCModel::load(filename)->get_hash() == model.get_hash(); }
+		std::chrono::duration<double> load = std::chrono::steady_clock::now() - start;
+		std::cout << (overlapping ? "overlapping N=" + std::to_string(pattern_size) : std::string("adjacent")) << ", " << file_size(filename) << ", "
+			<< learn.count()/n_iterations << ", " << save.count() << ", " << load.count()/n_iterations << ", " << (same ? "yes" : "no") << std::endl;
+	}
+}
+
+void bench_kernels(size_t n_types, size_t n_iterations)
+{
+	const size_t rows = 256; // Working set small enough to stay in cache
+	const size_t stride = (n_types + 3)/4*4;
+	std::default_random_engine generator(12345);
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> neigs = random_rows(rows,n_types,stride,generator);
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> waves = random_rows(rows,n_types,stride,generator);
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> work;
+
+	std::vector<const SimdKernels*> sets;
+	sets.push_back(&scalar_kernels());
+	if(sse2_kernels()) { sets.push_back(sse2_kernels()); }
+	if(avx2_kernels()) { sets.push_back(avx2_kernels()); }
+
+	std::cout << "kernels (n_types = " << n_types << "), multiply-normalize ns/call, entropy ns/call, max entropy error" << std::endl;
+	for(size_t k = 0; k <= sets.size(); k++)
+	{
+		const SimdKernels* set = k == 0 ? nullptr : sets[k - 1];
+		double checksum = 0;
+		// Multiply-normalize: re-copy the rows every pass so the values stay in a sane range
+		work = waves;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t it = 0; it < n_iterations; it++)
+		{
+			size_t r = it%rows;
+			if(r == 0) { work = waves; }
+			if(set == nullptr) { reference_multiply_normalize(&neigs[r*stride],&work[r*stride],n_types); }
+			else
+			{
+				double sum = set->multiply(&neigs[r*stride],&work[r*stride],n_types);
+				set->scale(&work[r*stride],n_types,1.0/sum);
+			}
+			checksum += work[r*stride];
+		}
+		std::chrono::duration<double> multiply_time = std::chrono::steady_clock::now() - start;
+		// Entropy
+		double max_error = 0;
+		start = std::chrono::steady_clock::now();
+		for(size_t it = 0; it < n_iterations; it++)
+		{
+			size_t r = it%rows;
+			double H = set == nullptr ? reference_entropy(&waves[r*stride],n_types) : set->entropy(&waves[r*stride],n_types);
+			checksum += H;
+		}
+		std::chrono::duration<double> entropy_time = std::chrono::steady_clock::now() - start;
+		for(size_t r = 0; set != nullptr && r < rows; r++)
+		{
+			double error = fabs(set->entropy(&waves[r*stride],n_types) - reference_entropy(&waves[r*stride],n_types));
+			if(error > max_error) { max_error = error; }
+		}
+		std::cout << (set == nullptr ? "reference" : set->name) << ", " << multiply_time.count()*1e9/n_iterations << ", "
+			<< entropy_time.count()*1e9/n_iterations << ", " << max_error << " (checksum " << checksum << ")" << std::endl;
+	}
+}
+
+void bench_collapse_cost(size_t max_types, size_t n_collapses)
+{
+	const size_t rows = 512; // Cells touched by the benchmark (8 per collapse)
+	const SimdKernels& k = simd_kernels();
+	std::default_random_engine generator(12345);
+	std::cout << "collapse cost (" << k.name << " kernels), n_types, recompute ns/collapse, incremental ns/collapse (checksums)" << std::endl;
+	for(size_t n_types = 4; n_types <= max_types; n_types *= 2)
+	{
+		const size_t stride = (n_types + 3)/4*4;
+		// Neighbour factors close to 1, so that the weights neither underflow nor overflow without renormalizing
+		std::uniform_real_distribution<double> factor(0.95,1.05);
+		std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> neigs(8*stride,0.0), log_neigs(8*stride,0.0);
+		for(size_t neig_i = 0; neig_i < 8; neig_i++)
+		{
+			for(size_t i = 0; i < n_types; i++) { neigs[neig_i*stride + i] = factor(generator); log_neigs[neig_i*stride + i] = log2(neigs[neig_i*stride + i]); }
+		}
+		std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> waves = random_rows(rows,n_types,stride,generator);
+		std::vector<double> freqs(waves.begin(),waves.begin() + n_types);
+
+		// Recompute: multiply, normalize and take the entropy of the whole row for every neighbour
+		double checksum_recompute = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t collapse = 0; collapse < n_collapses; collapse++)
+		{
+			for(size_t neig_i = 0; neig_i < 8; neig_i++)
+			{
+				double* wave = &waves[((collapse*8 + neig_i)%rows)*stride];
+				double sum = k.multiply(&neigs[neig_i*stride],wave,n_types);
+				k.scale(wave,n_types,1.0/sum);
+				checksum_recompute += k.entropy(wave,n_types);
+			}
+		}
+		std::chrono::duration<double> recompute_time = std::chrono::steady_clock::now() - start;
+
+		// Incremental: one pass updates the weights, their logarithms and the running sums
+		WaveFunction wave_function;
+		wave_function.reset(rows,freqs);
+		double checksum_incremental = 0;
+		start = std::chrono::steady_clock::now();
+		for(size_t collapse = 0; collapse < n_collapses; collapse++)
+		{
+			for(size_t neig_i = 0; neig_i < 8; neig_i++)
+			{
+				size_t cell = (collapse*8 + neig_i)%rows;
+				double sum, sum_wlogw;
+				k.multiply_log(&neigs[neig_i*stride],&log_neigs[neig_i*stride],wave_function[cell],wave_function.log_weights(cell),n_types,&sum,&sum_wlogw);
+				wave_function.set_sums(cell,sum,sum_wlogw);
+				checksum_incremental += wave_function.entropy(cell);
+			}
+		}
+		std::chrono::duration<double> incremental_time = std::chrono::steady_clock::now() - start;
+		std::cout << n_types << ", " << recompute_time.count()*1e9/n_collapses << ", " << incremental_time.count()*1e9/n_collapses
+			<< " (" << checksum_recompute << ", " << checksum_incremental << ")" << std::endl;
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef STRATEGY_BENCHMARK_H
+#define STRATEGY_BENCHMARK_H
+#include <string>
+#include "wfc.hpp"
+#include "chunk_world.hpp"
+#include "binary_map.hpp"
+/*
+Benchmarks
+	Description
+		Simple timing helpers for WFC. Each benchmark prints one row per measurement to std::cout.
+		Build with optimizations (e.g. cmake -DCMAKE_BUILD_TYPE=Release) before trusting the numbers.
+
+	Example use case:
+		bench_map_sizes("Maps/input_map.txt",64,2048); // 64x64, 128x128, ... , 2048x2048
+		bench_kernels(32,1000000); // SIMD kernels vs. the plain scalar loops for 32 tile types
+		bench_collapse_cost(64,100000); // Neighbour updates of one collapse for 4, 8, ... , 64 tile types
+		bench_batch("Maps/input_map.txt",256,64,8); // 256 maps of 64x64 on 1, 2, 4 and 8 threads
+		bench_chunks("Maps/input_map.txt",64,1000,100000); // 1000 chunks of 64x64 along a 100k cells wide world
+		bench_parallel("Maps/input_map.txt",4096,256,8); // One 4096x4096 map in 256x256 regions on 1, 2, 4 and 8 threads
+		bench_import("/tmp/bench_map.txt",2048,16,5); // Import of a 2048x2048 map file (about 14 MB)
+		bench_formats("/tmp/bench_map",2048,16); // Text vs. binary map files of 2048x2048 cells
+		bench_overlapping("Maps/input_map.txt",64,3,true); // Adjacent model vs. overlapping models with N=2 and N=3
+		bench_model_cache("Maps/input_map.txt","/tmp",3,20); // Learning vs. loading the compiled model
+*/
+
+/*
+* Synthetic input sample of n_types tile types (S0, S1, ...) for benchmarks with large tilesets: a smooth height
+* field of dim x dim cells quantized into n_types levels, so that neighbouring cells hold equal or adjacent levels
+* like terrain. Deterministic.
+*/
+StringMap synthetic_sample(size_t n_types, size_t dim);
+/*
+* Number of pairs of neighbouring cells (counted from both sides, in all 8 directions) of map whose tiles may not be
+* neighbours according to model. The tile ids of map must be those of model, e.g. of a map generated from it.
+*/
+size_t count_violations(const WFCModel& model, const StringMap& map);
+/*
+* Times WFC::generate_map for square maps, doubling the side length from min_dim up to max_dim.
+* Prints map size, cell count, seconds and cells per second for each size.
+* options selects e.g. the solver mode.
+*/
+void bench_map_sizes(std::string input_map, size_t min_dim, size_t max_dim, WFCOptions options = WFCOptions());
+/*
+* Times the multiply-normalize and entropy kernels of every instruction set available on this CPU
+* (see simd.hpp) against plain scalar loops using log2, on rows of n_types probabilities.
+* Prints nanoseconds per call and the largest entropy difference to the reference.
+*/
+void bench_kernels(size_t n_types, size_t n_iterations);
+/*
+* Times the 8 neighbour updates that follow one collapse, for 4, 8, ... up to max_types tile types:
+* recomputing the entropy from scratch after multiply-normalize (the old update) vs. updating the running
+* sums of WaveFunction and querying the entropy in O(1). Prints nanoseconds per collapse.
+*/
+void bench_collapse_cost(size_t max_types, size_t n_collapses);
+/*
+* Times WFC::generate_batch of n_maps maps of dim x dim cells with 1, 2, 4, ... up to max_threads threads.
+* Prints threads, seconds, maps per second and the speedup over one thread.
+*/
+void bench_batch(std::string input_map, size_t n_maps, size_t dim, size_t max_threads, WFCOptions options = WFCOptions());
+/*
+* Times ChunkWorld: generates n_chunks chunks of chunk_size x chunk_size cells along a diagonal through a
+* world_size x world_size world, keeping at most 16 chunks resident. Prints seconds, cells per second and
+* the number of resident chunks.
+*/
+void bench_chunks(std::string input_map, size_t chunk_size, size_t n_chunks, int64_t world_size, WFCOptions options = WFCOptions());
+/*
+* Times WFC::generate_map_parallel of one dim x dim map split into regions of region_size x region_size cells
+* with 1, 2, 4, ... up to max_threads threads (e.g. dim = 1024 and 4096). Prints threads, seconds, cells per
+* second, the speedup over one thread and the adjacency violations of the map (see count_violations). The first
+* line times the sequential generate_map for reference.
+*/
+void bench_parallel(std::string input_map, size_t dim, size_t region_size, size_t max_threads, WFCOptions options = WFCOptions());
+/*
+* Writes a random dim x dim map of n_types tile types (in runs, like real maps) to filename and times importing it
+* with StringMap (memory-mapped, single pass) against the old std::getline/std::stringstream parser.
+* Prints megabytes, seconds per import and megabytes per second of both, averaged over n_iterations.
+*/
+void bench_import(std::string filename, size_t dim, size_t n_types, size_t n_iterations);
+/*
+* Writes a random dim x dim map of n_types tile types as text (filename.txt) and in the binary format (filename.wfcm,
+* see binary_map.hpp). Prints the file sizes and the seconds to write and read each, and the nanoseconds per random
+* cell read through BinaryMapReader.
+*/
+void bench_formats(std::string filename, size_t dim, size_t n_types);
+/*
+* Learns the adjacent model and the overlapping models with N = 2 ... max_pattern_size (with rotations and reflections
+* if symmetry) from input_map and generates one dim x dim map with each (bitset mode, backtracking). Prints the number
+* of patterns, the seconds to learn and to generate, cells per second and the contradiction counters.
+*/
+void bench_overlapping(std::string input_map, size_t dim, size_t max_pattern_size, bool symmetry);
+/*
+* Learns the adjacent model and the overlapping model with N = pattern_size (with symmetry) from input_map, saves
+* each as a compiled model in cache_dir and loads it again. Prints the compiled file size and the seconds to learn,
+* to save and to load (averaged over n_iterations), and whether the loaded model has the same hash.
+*/
+void bench_model_cache(std::string input_map, std::string cache_dir, size_t pattern_size, size_t n_iterations);
+
+#endif
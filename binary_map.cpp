@@ -0,0 +1,150 @@
+#include "binary_map.hpp"
+#include <stdexcept>
+#include <cstring>
+
+static const char magic[4] = {'W','F','C','M'};
+static const uint8_t version = 1;
+
+// Little-endian encoding and decoding of the header fields
+static void put(std::vector<uint8_t>& out, uint64_t value, size_t n_bytes)
+{
+	for(size_t i = 0; i < n_bytes; i++) { out.push_back((value >> (8*i)) & 0xff); }
+}
+
+static uint64_t get(const uint8_t* in, size_t n_bytes)
+{
+	uint64_t value = 0;
+	for(size_t i = 0; i < n_bytes; i++) { value |= (uint64_t)in[i] << (8*i); }
+	return value;
+}
+
+static size_t row_size(size_t width, unsigned int bits) { return (width*bits + 7)/8; }
+
+unsigned int BinaryMapWriter::bits_per_cell(size_t n_types)
+{
+	if(n_types <= 2) { return 1; }
+	if(n_types <= 4) { return 2; }
+	if(n_types <= 16) { return 4; }
+	if(n_types <= 256) { return 8; }
+	return 16;
+}
+
+BinaryMapWriter::BinaryMapWriter(const std::string& filename, size_t width, size_t height, const std::vector<std::string>& palette) : buffer(1 << 16) , width(width) , height(height) , n_types(palette.size()) , bits(bits_per_cell(palette.size())) , rows(0) , closed(false)
+{
+	ofs.rdbuf()->pubsetbuf(buffer.data(),buffer.size());
+	ofs.open(filename,std::ofstream::out | std::ofstream::binary);
+	if(!ofs) { throw std::runtime_error("BinaryMapWriter: cannot open " + filename); }
+	std::vector<uint8_t> header(magic,magic + 4);
+	put(header,version,1);
+	put(header,bits,1);
+	put(header,0,2);
+	put(header,width,8);
+	put(header,height,8);
+	put(header,palette.size(),4);
+	for(const std::string& type : palette)
+	{
+		if(type.size() > 0xffff) { throw std::length_error("BinaryMapWriter: tile type name longer than 65535 bytes"); }
+		put(header,type.size(),2);
+		header.insert(header.end(),type.begin(),type.end());
+	}
+	header.resize((header.size() + 7)/8*8,0);
+	ofs.write(reinterpret_cast<const char*>(header.data()),header.size());
+	packed.resize(row_size(width,bits));
+}
+
+BinaryMapWriter::~BinaryMapWriter()
+{
+	if(!closed) { ofs.close(); }
+}
+
+void BinaryMapWriter::write_row(const tile_id* row)
+{
+	if(rows == height) { throw std::out_of_range("BinaryMapWriter::write_row: all rows already written"); }
+	std::fill(packed.begin(),packed.end(),0);
+	for(size_t x = 0; x < width; x++)
+	{
+		if(row[x] >= n_types) { throw std::invalid_argument("BinaryMapWriter::write_row: tile id not in palette"); }
+		if(bits == 16)
+		{
+			packed[2*x] = row[x] & 0xff;
+			packed[2*x + 1] = row[x] >> 8;
+		}
+		else
+		{
+			size_t bit = x*bits;
+			packed[bit/8] |= row[x] << (bit % 8);
+		}
+	}
+	ofs.write(reinterpret_cast<const char*>(packed.data()),packed.size());
+	rows++;
+}
+
+void BinaryMapWriter::close()
+{
+	if(closed) { return; }
+	closed = true;
+	ofs.close();
+	if(rows != height) { throw std::runtime_error("BinaryMapWriter::close: map is missing rows"); }
+	if(!ofs) { throw std::runtime_error("BinaryMapWriter::close: writing failed"); }
+}
+
+bool BinaryMapReader::is_binary_map(const char* data, size_t size)
+{
+	return size >= 4 && std::memcmp(data,magic,4) == 0;
+}
+
+BinaryMapReader::BinaryMapReader(const std::string& filename) : file(filename) , cells(nullptr) , row_bytes(0) , width(0) , height(0) , bits(0)
+{
+	const uint8_t* begin = reinterpret_cast<const uint8_t*>(file.data());
+	const uint8_t* end = begin + file.size();
+	if(!is_binary_map(file.data(),file.size()) || file.size() < 28) { throw std::runtime_error("BinaryMapReader: " + filename + " is not a binary map"); }
+	if(begin[4] != version) { throw std::runtime_error("BinaryMapReader: unsupported version in " + filename); }
+	bits = begin[5];
+	if(bits != 1 && bits != 2 && bits != 4 && bits != 8 && bits != 16) { throw std::runtime_error("BinaryMapReader: invalid bits per cell in " + filename); }
+	width = get(begin + 8,8);
+	height = get(begin + 16,8);
+	size_t n_types = get(begin + 24,4);
+	const uint8_t* p = begin + 28;
+	for(size_t i = 0; i < n_types; i++)
+	{
+		if(end - p < 2) { throw std::runtime_error("BinaryMapReader: truncated palette in " + filename); }
+		size_t len = get(p,2);
+		p += 2;
+		if((size_t)(end - p) < len) { throw std::runtime_error("BinaryMapReader: truncated palette in " + filename); }
+		types.push_back(std::string(reinterpret_cast<const char*>(p),len));
+		p += len;
+	}
+	size_t offset = ((p - begin) + 7)/8*8;
+	row_bytes = row_size(width,bits);
+	if(offset > file.size() || (height > 0 && (file.size() - offset)/height < row_bytes)) { throw std::runtime_error("BinaryMapReader: truncated cells in " + filename); }
+	cells = begin + offset;
+}
+
+tile_id BinaryMapReader::at(size_t x, size_t y) const
+{
+	if(x >= width || y >= height) { throw std::out_of_range("BinaryMapReader::at: cell outside the map"); }
+	return cell(cells + y*row_bytes,x);
+}
+
+void BinaryMapReader::read_row(size_t y, tile_id* out) const
+{
+	if(y >= height) { throw std::out_of_range("BinaryMapReader::read_row: row outside the map"); }
+	const uint8_t* row = cells + y*row_bytes;
+	for(size_t x = 0; x < width; x++) { out[x] = cell(row,x); }
+}
+
+StringMap BinaryMapReader::to_string_map() const
+{
+	StringMap sm(width,height,types);
+	std::vector<tile_id> row(width);
+	for(size_t y = 0; y < height; y++)
+	{
+		read_row(y,row.data());
+		for(tile_id id : row)
+		{
+			if(id >= types.size()) { throw std::runtime_error("BinaryMapReader: tile id not in palette"); }
+			sm.push_back(id);
+		}
+	}
+	return sm;
+}
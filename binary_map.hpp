@@ -0,0 +1,122 @@
+#ifndef STRATEGY_BINARY_MAP_H
+#define STRATEGY_BINARY_MAP_H
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include "wfc.hpp"
+#include "mapped_file.hpp"
+
+/*
+Binary map format
+	Compact alternative to the text format of StringMap. All numbers are little-endian.
+		offset 0	"WFCM"
+		offset 4	uint8 version (1), uint8 bits per cell, 2 zero bytes
+		offset 8	uint64 width, uint64 height
+		offset 24	uint32 number of tile types, then per type a uint16 length and the name (the palette)
+		then		zero padding up to a multiple of 8 bytes, followed by height rows of tile ids
+	Every row starts on a byte boundary and packs width tile ids (indices to the palette) at 1, 2, 4, 8 or 16
+	bits per cell, the smallest that fits the palette, lowest bits first. A 60x60 map of 4 tile types takes
+	900 bytes of cells.
+
+BinaryMapWriter
+	Description
+		Writes a map in the binary format one row at a time, so a row can be written as soon as it is final and
+		the whole map never has to be in memory. Throws std::runtime_error if the file cannot be written.
+
+	Example use case:
+		BinaryMapWriter writer("generated_map.wfcm",width,height,sm.get_types());
+		for(size_t y = 0; y < height; y++) { writer.write_row(&sm.get_ids()[y*width]); }
+		writer.close();
+
+BinaryMapReader
+	Description
+		Memory-maps a map in the binary format (see MappedFile). Any cell can be read without decoding the rest
+		of the file, so large maps can be sampled without loading them.
+		Throws std::runtime_error if the file is not a valid binary map.
+
+	Example use case:
+		BinaryMapReader reader("generated_map.wfcm");
+		std::string type = reader.get_types()[reader.at(100,20)];
+		StringMap sm = reader.to_string_map();
+*/
+class BinaryMapWriter
+{
+public:
+	/*
+	* Creates filename and writes the header
+	*/
+	BinaryMapWriter(const std::string& filename, size_t width, size_t height, const std::vector<std::string>& palette);
+	/*
+	* Closes the file if close() has not been called. Errors are ignored here, call close() to see them.
+	*/
+	~BinaryMapWriter();
+	/*
+	* Appends the next row (width tile ids, each < palette size)
+	*/
+	void write_row(const tile_id* row);
+	/*
+	* Flushes and closes the file. Throws if not all height rows were written or writing failed.
+	*/
+	void close();
+
+	size_t rows_written() const { return rows; }
+	/*
+	* Bits per cell used for a palette of n_types tile types
+	*/
+	static unsigned int bits_per_cell(size_t n_types);
+private:
+	std::vector<char> buffer; // Buffer of ofs, larger than the default
+	std::ofstream ofs;
+	std::vector<uint8_t> packed; // One packed row
+	size_t width;
+	size_t height;
+	size_t n_types;
+	unsigned int bits;
+	size_t rows;
+	bool closed;
+};
+
+class BinaryMapReader
+{
+public:
+	explicit BinaryMapReader(const std::string& filename);
+	/*
+	* Returns the tile id of cell (x,y). Throws std::out_of_range if (x,y) is outside the map.
+	*/
+	tile_id at(size_t x, size_t y) const;
+	/*
+	* Decodes row y into out (width tile ids)
+	*/
+	void read_row(size_t y, tile_id* out) const;
+	/*
+	* Decodes the whole map
+	*/
+	StringMap to_string_map() const;
+
+	size_t get_width() const { return width; }
+	size_t get_height() const { return height; }
+	unsigned int get_bits() const { return bits; }
+	const std::vector<std::string>& get_types() const { return types; }
+	/*
+	* Returns true if the size bytes at data start like a binary map
+	*/
+	static bool is_binary_map(const char* data, size_t size);
+private:
+	tile_id cell(const uint8_t* row, size_t x) const
+	{
+		if(bits == 16) { return row[2*x] | (row[2*x + 1] << 8); }
+		size_t bit = x*bits;
+		return (row[bit/8] >> (bit % 8)) & ((1u << bits) - 1);
+	}
+
+	MappedFile file;
+	const uint8_t* cells; // First row
+	size_t row_bytes;
+	size_t width;
+	size_t height;
+	unsigned int bits;
+	std::vector<std::string> types;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "chunk_world.hpp"
+
+ChunkWorld::ChunkWorld(std::shared_ptr<const WFCModel> model, size_t chunk_size, uint64_t seed, size_t max_resident, WFCOptions options)
+	: model(model) , solver(model,options) , lattice(model,chunk_size,seed) , chunk_size(chunk_size) , max_resident(max_resident) , n_generated(0)
+{
+	if(max_resident == 0) { throw std::invalid_argument("ChunkWorld: max_resident == 0"); }
+}
+
+const std::vector<tile_id>& ChunkWorld::chunk(int64_t cx, int64_t cy)
+{
+	ChunkKey key = {cx,cy};
+	auto found = index.find(key);
+	if(found != index.end())
+	{
+		chunks.splice(chunks.begin(),chunks,found->second); // Mark as most recently used
+		return found->second->second;
+	}
+	if(chunks.size() >= max_resident)
+	{
+		// Evict the least recently used chunk and reuse its buffer
+		chunks.splice(chunks.begin(),chunks,std::prev(chunks.end()));
+		index.erase(chunks.front().first);
+		chunks.front().first = key;
+	}
+	else
+	{
+		chunks.push_front(std::make_pair(key,std::vector<tile_id>()));
+	}
+	index[key] = chunks.begin();
+	generate(cx,cy,chunks.front().second);
+	return chunks.front().second;
+}
+
+tile_id ChunkWorld::at(int64_t x, int64_t y)
+{
+	int64_t size = chunk_size;
+	// Floor division, so that e.g. x = -1 lies in chunk -1
+	int64_t cx = x >= 0 ? x/size : -((-x + size - 1)/size);
+	int64_t cy = y >= 0 ? y/size : -((-y + size - 1)/size);
+	return chunk(cx,cy)[(y - cy*size)*size + (x - cx*size)];
+}
+
+StringMap ChunkWorld::chunk_map(int64_t cx, int64_t cy)
+{
+	StringMap sm(chunk_size,chunk_size,model->get_types());
+	for(tile_id id : chunk(cx,cy)) { sm.push_back(id); }
+	return sm;
+}
+
+void ChunkWorld::generate(int64_t cx, int64_t cy, std::vector<tile_id>& out)
+{
+	size_t n = chunk_size + 1;
+	lattice.region(solver,cx,cy,n,n,region,scratch);
+	// Keep the first chunk_size rows and columns; the last ones are the first of the neighbouring chunks
+	out.resize(chunk_size*chunk_size);
+	for(size_t y = 0; y < chunk_size; y++)
+	{
+		std::copy(region.begin() + y*n, region.begin() + y*n + chunk_size, out.begin() + y*chunk_size);
+	}
+	n_generated++;
+}
@@ -0,0 +1,79 @@
+#ifndef STRATEGY_CHUNK_WORLD_H
+#define STRATEGY_CHUNK_WORLD_H
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <stdint.h>
+#include "wfc.hpp"
+#include "seam_lattice.hpp"
+
+/*
+ChunkWorld
+	Description
+		Unbounded world of WFC tiles that is generated in chunks of chunk_size x chunk_size cells on demand.
+		A chunk only depends on the world seed and its coordinate, never on which chunks were generated
+		before, and neighbouring chunks fit together at their borders: chunk (cx,cy) is lattice cell (cx,cy) of a
+		SeamLattice, generated as a (chunk_size+1)^2 region whose border is fixed to its four seams. The chunk keeps
+		all but the last row and column (those belong to the chunks to the right and below, and are generated
+		from the same seams there).
+		Only the most recently used max_resident chunks stay in memory; the others are dropped and generated again
+		(with the same result) when they are needed again.
+
+	Example use case:
+		ChunkWorld world(std::make_shared<WFCModel>("Maps/input_map.txt"),64,42);
+		tile_id id = world.at(100000,-5); // Generates chunk (1562,-1) if it is not resident
+		StringMap sm = world.chunk_map(0,0);
+*/
+class ChunkWorld
+{
+public:
+	/*
+	* options selects the solver of the seams and chunks (see WFCOptions)
+	*/
+	ChunkWorld(std::shared_ptr<const WFCModel> model, size_t chunk_size, uint64_t seed, size_t max_resident = 64, WFCOptions options = WFCOptions());
+	/*
+	* Returns the chunk_size*chunk_size tile ids (row by row) of chunk (cx,cy), which covers the cells
+	* [cx*chunk_size,(cx+1)*chunk_size) x [cy*chunk_size,(cy+1)*chunk_size). Generates it if it is not resident.
+	* The reference is valid until the next call of chunk, at or chunk_map.
+	*/
+	const std::vector<tile_id>& chunk(int64_t cx, int64_t cy);
+	/*
+	* Tile id of world cell (x,y)
+	*/
+	tile_id at(int64_t x, int64_t y);
+	/*
+	* Chunk (cx,cy) as a StringMap
+	*/
+	StringMap chunk_map(int64_t cx, int64_t cy);
+
+	size_t get_chunk_size() const { return chunk_size; }
+	size_t resident() const { return chunks.size(); }
+	size_t generated() const { return n_generated; } // Number of chunks generated so far (including regenerated ones)
+private:
+	struct ChunkKey
+	{
+		int64_t x, y;
+		bool operator==(const ChunkKey& other) const { return x == other.x && y == other.y; }
+	};
+	struct ChunkKeyHash
+	{
+		size_t operator()(const ChunkKey& key) const { return (size_t)Xoshiro256::split((uint64_t)key.x,(uint64_t)key.y); }
+	};
+	typedef std::list<std::pair<ChunkKey,std::vector<tile_id>>> ChunkList;
+
+	void generate(int64_t cx, int64_t cy, std::vector<tile_id>& out);
+
+	std::shared_ptr<const WFCModel> model;
+	WFCSolver solver; // Reused for every seam and chunk
+	SeamLattice lattice;
+	size_t chunk_size;
+	size_t max_resident;
+	size_t n_generated;
+	ChunkList chunks; // Resident chunks, most recently used first
+	std::unordered_map<ChunkKey,ChunkList::iterator,ChunkKeyHash> index; // Chunk coordinate -> position in chunks
+	std::vector<tile_id> region; // Scratch: chunk including the seams to the next chunks
+	std::vector<tile_id> scratch;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "domains.hpp"
+#include <algorithm>
+
+void Domains::reset(size_t n_cells_, const std::vector<double>& weights_)
+{
+	n_cells = n_cells_;
+	n_types = weights_.size();
+	words_per_cell = (n_types + 63)/64;
+	weights = weights_;
+	wlogws.assign(n_types,0.0);
+	// The full domain, its sums and its popcount are computed once and copied to every cell
+	full.assign(words_per_cell,0);
+	double sum = 0, sum_wlogw = 0;
+	uint32_t count = 0;
+	for(size_t t = 0; t < n_types; t++)
+	{
+		if(weights[t] <= 0) { continue; } // Types that never occur are never allowed
+		wlogws[t] = weights[t]*log2(weights[t]);
+		full[t/64] |= (uint64_t)1 << (t%64);
+		sum += weights[t];
+		sum_wlogw += wlogws[t];
+		count++;
+	}
+	data.resize(n_cells*words_per_cell);
+	for(size_t cell = 0; cell < n_cells; cell++)
+	{
+		std::copy(full.begin(), full.end(), data.begin() + cell*words_per_cell);
+	}
+	counts.assign(n_cells,count);
+	sums.assign(n_cells,sum);
+	wlogw_sums.assign(n_cells,sum_wlogw);
+	full_count = count;
+	full_sum = sum;
+	full_wlogw_sum = sum_wlogw;
+}
+
+void Domains::fill(size_t cell)
+{
+	std::copy(full.begin(), full.end(), data.begin() + cell*words_per_cell);
+	counts[cell] = full_count;
+	sums[cell] = full_sum;
+	wlogw_sums[cell] = full_wlogw_sum;
+}
+
+void Domains::clear()
+{
+	std::vector<uint64_t>().swap(data);
+	std::vector<uint32_t>().swap(counts);
+	std::vector<double>().swap(sums);
+	std::vector<double>().swap(wlogw_sums);
+	n_cells = 0; n_types = 0; words_per_cell = 0;
+}
+
+void Domains::ban(size_t cell, size_t type_idx)
+{
+	uint64_t& word = data[cell*words_per_cell + type_idx/64];
+	uint64_t bit = (uint64_t)1 << (type_idx%64);
+	if(!(word & bit)) { return; }
+	word &= ~bit;
+	counts[cell]--;
+	sums[cell] -= weights[type_idx];
+	wlogw_sums[cell] -= wlogws[type_idx];
+}
+
+void Domains::restore(size_t cell, const uint64_t* domain, double sum, double sum_wlogw)
+{
+	uint32_t count = 0;
+	for(size_t w = 0; w < words_per_cell; w++)
+	{
+		data[cell*words_per_cell + w] = domain[w];
+		count += __builtin_popcountll(domain[w]);
+	}
+	counts[cell] = count;
+	sums[cell] = sum;
+	wlogw_sums[cell] = sum_wlogw;
+}
+
+void Domains::collapse(size_t cell, size_t type_idx)
+{
+	uint64_t* domain = &data[cell*words_per_cell];
+	std::fill(domain, domain + words_per_cell, 0);
+	domain[type_idx/64] = (uint64_t)1 << (type_idx%64);
+	counts[cell] = 1;
+	sums[cell] = weights[type_idx];
+	wlogw_sums[cell] = wlogws[type_idx];
+}
+
+size_t Domains::weighted_type(size_t cell, double value) const
+{
+	const uint64_t* domain = &data[cell*words_per_cell];
+	double current = 0;
+	size_t last = n_types;
+	for(size_t w = 0; w < words_per_cell; w++)
+	{
+		uint64_t bits = domain[w];
+		while(bits)
+		{
+			size_t t = w*64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			current += weights[t];
+			if(value < current) { return t; }
+			last = t;
+		}
+	}
+	return last; // value rounded up to the sum of the weights (or empty domain: n_types)
+}
+
+size_t Domains::first_type(size_t cell) const
+{
+	const uint64_t* domain = &data[cell*words_per_cell];
+	for(size_t w = 0; w < words_per_cell; w++)
+	{
+		if(domain[w]) { return w*64 + __builtin_ctzll(domain[w]); }
+	}
+	return n_types;
+}
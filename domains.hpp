@@ -0,0 +1,113 @@
+#ifndef STRATEGY_DOMAINS_H
+#define STRATEGY_DOMAINS_H
+#include <vector>
+#include <stdint.h>
+#include <math.h>
+
+/*
+Domains
+	Description
+		Boolean wave function used by the bitset solver mode of WFC (SolverMode::bitset).
+		The domain of each cell is a bitset of the tile types that are still allowed there,
+		stored as words_per_cell 64 bit words in one contiguous buffer.
+		Tile types are weighted by a global weight (their frequency in the input sample). Like
+		WaveFunction, every cell keeps the running sums sum(w) and sum(w*log2(w)) over its allowed
+		types, so that banning a type and querying the entropy are O(1).
+*/
+class Domains
+{
+public:
+	Domains() : n_cells(0), n_types(0), words_per_cell(0) {}
+	/*
+	* Resizes to n_cells cells that allow every type with non-zero weight. weights holds one weight per type.
+	*/
+	void reset(size_t n_cells, const std::vector<double>& weights);
+	/*
+	* Releases all memory
+	*/
+	void clear();
+
+	uint64_t* operator[](size_t cell) { return &data[cell*words_per_cell]; }
+	const uint64_t* operator[](size_t cell) const { return &data[cell*words_per_cell]; }
+
+	bool contains(size_t cell, size_t type_idx) const { return (data[cell*words_per_cell + type_idx/64] >> (type_idx%64)) & 1; }
+	/*
+	* Removes type_idx from the domain of cell and subtracts its weight from the running sums
+	*/
+	void ban(size_t cell, size_t type_idx);
+	/*
+	* Removes all types from the domain of cell that are not set in mask (words_per_cell words).
+	* Returns the number of removed types. Words is the number of words if known at compile time, else 0.
+	*/
+	template <size_t Words> size_t restrict_to(size_t cell, const uint64_t* mask)
+	{
+		const size_t words = Words ? Words : words_per_cell;
+		uint64_t* domain = &data[cell*words];
+		size_t removed = 0;
+		for(size_t w = 0; w < words; w++)
+		{
+			uint64_t banned = domain[w] & ~mask[w];
+			if(banned == 0) { continue; }
+			domain[w] &= mask[w];
+			// Subtract the weights of the banned types from the running sums
+			while(banned)
+			{
+				size_t t = w*64 + __builtin_ctzll(banned);
+				banned &= banned - 1;
+				sums[cell] -= weights[t];
+				wlogw_sums[cell] -= wlogws[t];
+				removed++;
+			}
+		}
+		counts[cell] -= removed;
+		return removed;
+	}
+	size_t restrict_to(size_t cell, const uint64_t* mask) { return restrict_to<0>(cell,mask); }
+	/*
+	* Allows every type with non-zero weight in cell again
+	*/
+	void fill(size_t cell);
+	/*
+	* Overwrites the domain (words() words) and the running sums of cell, e.g. with a snapshot taken earlier
+	*/
+	void restore(size_t cell, const uint64_t* domain, double sum, double sum_wlogw);
+	/*
+	* Bans every type of cell except type_idx
+	*/
+	void collapse(size_t cell, size_t type_idx);
+	/*
+	* Returns the index of the allowed type that represents value, which must be in [0,sum(cell))
+	*/
+	size_t weighted_type(size_t cell, double value) const;
+	/*
+	* Returns the lowest allowed type of cell, or n_types if the domain is empty
+	*/
+	size_t first_type(size_t cell) const;
+
+	size_t count(size_t cell) const { return counts[cell]; } // Number of allowed types
+	double sum(size_t cell) const { return sums[cell]; }
+	double sum_wlogw(size_t cell) const { return wlogw_sums[cell]; }
+	/*
+	* Shannon entropy of the normalized weights of the allowed types, from the running sums
+	*/
+	double entropy(size_t cell) const { return counts[cell] > 1 && sums[cell] > 0 ? log2(sums[cell]) - wlogw_sums[cell]/sums[cell] : 0; }
+
+	size_t size() const { return n_cells; }
+	size_t get_n_types() const { return n_types; }
+	size_t words() const { return words_per_cell; }
+private:
+	std::vector<uint64_t> data; // n_cells*words_per_cell words
+	std::vector<uint32_t> counts; // Popcount of each domain
+	std::vector<double> sums; // sum(w) per cell
+	std::vector<double> wlogw_sums; // sum(w*log2(w)) per cell
+	std::vector<double> weights; // w per type
+	std::vector<double> wlogws; // w*log2(w) per type
+	std::vector<uint64_t> full; // Domain that allows every type with non-zero weight
+	uint32_t full_count;
+	double full_sum, full_wlogw_sum;
+	size_t n_cells;
+	size_t n_types;
+	size_t words_per_cell;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "entropy_queue.hpp"
+
+const unsigned int EntropyQueue::npos;
+
+void EntropyQueue::reset(size_t n_cells)
+{
+	heap.clear();
+	heap.reserve(n_cells);
+	position.assign(n_cells, npos);
+}
+
+void EntropyQueue::push(unsigned int cell, double entropy)
+{
+	if(cell >= position.size()) { throw std::out_of_range("EntropyQueue::push: cell >= n_cells"); }
+	if(position[cell] != npos) { throw std::invalid_argument("EntropyQueue::push: cell already in queue"); }
+	heap.push_back(std::make_pair(entropy, cell));
+	position[cell] = heap.size() - 1;
+	sift_up(heap.size() - 1);
+}
+
+void EntropyQueue::update(unsigned int cell, double entropy)
+{
+	if(!contains(cell)) { throw std::out_of_range("EntropyQueue::update: cell not in queue"); }
+	size_t pos = position[cell];
+	double old_entropy = heap[pos].first;
+	heap[pos].first = entropy;
+	if(entropy < old_entropy) { sift_up(pos); } else { sift_down(pos); }
+}
+
+void EntropyQueue::erase(unsigned int cell)
+{
+	if(!contains(cell)) { return; }
+	size_t pos = position[cell];
+	position[cell] = npos;
+	std::pair<double,unsigned int> last = heap.back();
+	heap.pop_back();
+	if(pos == heap.size()) { return; } // Erased the last node, nothing to fix
+	std::pair<double,unsigned int> removed = heap[pos];
+	place(pos, last);
+	if(last < removed) { sift_up(pos); } else { sift_down(pos); }
+}
+
+unsigned int EntropyQueue::pop()
+{
+	if(heap.empty()) { throw std::out_of_range("EntropyQueue::pop: queue is empty"); }
+	unsigned int cell = heap[0].second;
+	erase(cell);
+	return cell;
+}
+
+void EntropyQueue::sift_up(size_t pos)
+{
+	std::pair<double,unsigned int> node = heap[pos];
+	while(pos > 0)
+	{
+		size_t parent = (pos - 1)/2;
+		if(!(node < heap[parent])) { break; }
+		place(pos, heap[parent]);
+		pos = parent;
+	}
+	place(pos, node);
+}
+
+void EntropyQueue::sift_down(size_t pos)
+{
+	std::pair<double,unsigned int> node = heap[pos];
+	size_t n = heap.size();
+	while(true)
+	{
+		size_t child = 2*pos + 1;
+		if(child >= n) { break; }
+		if(child + 1 < n && heap[child + 1] < heap[child]) { child++; } // Pick the smaller child
+		if(!(heap[child] < node)) { break; }
+		place(pos, heap[child]);
+		pos = child;
+	}
+	place(pos, node);
+}
@@ -0,0 +1,58 @@
+#ifndef STRATEGY_ENTROPY_QUEUE_H
+#define STRATEGY_ENTROPY_QUEUE_H
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+/*
+EntropyQueue
+	Description
+		Indexed binary min-heap of (shannon entropy, wave index) pairs used by WFC::generate_map.
+		Every cell of the wave function has a slot in a position table, so looking up, updating
+		(decrease-key or increase-key) and erasing a cell are O(log N) instead of a linear scan.
+		Ties in entropy are broken by the wave index, which gives the same ordering as sorting
+		the pairs with std::sort.
+*/
+class EntropyQueue
+{
+public:
+	EntropyQueue() {}
+	/*
+	* Empties the queue and sizes the position table for n_cells cells
+	*/
+	void reset(size_t n_cells);
+	/*
+	* Inserts cell with given entropy. The cell must not be in the queue already.
+	*/
+	void push(unsigned int cell, double entropy);
+	/*
+	* Changes the entropy of a cell that is in the queue and restores the heap order
+	*/
+	void update(unsigned int cell, double entropy);
+	/*
+	* Removes cell from the queue (no-op if the cell is not queued)
+	*/
+	void erase(unsigned int cell);
+	/*
+	* Removes and returns the cell with the lowest entropy
+	*/
+	unsigned int pop();
+	/*
+	* Returns the cell stored at heap position pos. Useful for picking a random queued cell.
+	*/
+	unsigned int at(size_t pos) const { return heap.at(pos).second; }
+
+	bool contains(unsigned int cell) const { return cell < position.size() && position[cell] != npos; }
+	size_t size() const { return heap.size(); }
+	bool empty() const { return heap.empty(); }
+private:
+	static const unsigned int npos = static_cast<unsigned int>(-1);
+	void sift_up(size_t pos);
+	void sift_down(size_t pos);
+	void place(size_t pos, const std::pair<double,unsigned int>& node) { heap[pos] = node; position[node.second] = pos; }
+
+	std::vector<std::pair<double,unsigned int>> heap; //first: shannon entropy, second: index to wave_function
+	std::vector<unsigned int> position; // position[cell]: index of cell in heap, npos if not queued
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef STRATEGY_GRID_H
+#define STRATEGY_GRID_H
+#include <vector>
+#include <stdint.h>
+
+/*
+Grid
+	Description
+		Neighbour lookup for a dim_x*dim_y map stored row by row. The 8 directions are numbered like the rows of
+		neig_probs, clock-wise from 9 o'clock: W, NW, N, NE, E, SE, S, SW.
+		Every cell belongs to one of 16 border classes (interior, left/right/top/bottom edge, corners, rows or
+		columns of width 1). For each class the offsets to the 8 neighbours and a bit mask of the directions
+		that exist are computed once by reset(), so a lookup is a table read and an add instead of divisions and
+		bounds checks. The class of each cell is stored in one byte, reallocated only when the map grows.
+		With wrap, the map is a torus: cells on opposite borders are neighbours, which makes the map tile
+		seamlessly. A direction that would lead back to the cell itself (a map 1 cell wide) does not exist.
+
+	Example use case:
+		Grid grid;
+		grid.reset(dim_x,dim_y);
+		uint8_t valid = grid.mask(idx);
+		const int* offsets = grid.offsets(idx);
+		for(unsigned int dir = 0; dir < 8; dir++) { if(valid >> dir & 1) { visit(idx + offsets[dir],dir); } }
+*/
+class Grid
+{
+public:
+	Grid() : dim_x(0), dim_y(0), wrap(false) {}
+	/*
+	* Sets up the tables for a dim_x*dim_y map
+	*/
+	void reset(size_t dim_x, size_t dim_y, bool wrap = false)
+	{
+		this->dim_x = dim_x;
+		this->dim_y = dim_y;
+		this->wrap = wrap;
+		static const int dx[8] = {-1,-1,0,1,1,1,0,-1};
+		static const int dy[8] = {0,-1,-1,-1,0,1,1,1};
+		for(unsigned int c = 0; c < 16; c++)
+		{
+			// Bit 0/1: cell is in the first/last column, bit 2/3: cell is in the first/last row
+			masks[c] = 0;
+			for(unsigned int dir = 0; dir < 8; dir++)
+			{
+				long long x = dx[dir], y = dy[dir];
+				bool x_wraps = (x < 0 && (c & 1)) || (x > 0 && (c & 2));
+				bool y_wraps = (y < 0 && (c & 4)) || (y > 0 && (c & 8));
+				if(x_wraps) { x += x < 0 ? (long long)dim_x : -(long long)dim_x; }
+				if(y_wraps) { y += y < 0 ? (long long)dim_y : -(long long)dim_y; }
+				table[c][dir] = (int)(y*(long long)dim_x + x);
+				bool exists = wrap ? table[c][dir] != 0 : !x_wraps && !y_wraps;
+				if(exists) { masks[c] |= 1 << dir; }
+			}
+		}
+		border.resize(dim_x*dim_y);
+		for(size_t y = 0; y < dim_y; y++)
+		{
+			uint8_t row = (y == 0 ? 4 : 0) | (y + 1 == dim_y ? 8 : 0);
+			for(size_t x = 0; x < dim_x; x++)
+			{
+				border[y*dim_x + x] = row | (x == 0 ? 1 : 0) | (x + 1 == dim_x ? 2 : 0);
+			}
+		}
+	}
+	/*
+	* Bit dir is set if cell idx has a neighbour in direction dir
+	*/
+	uint8_t mask(unsigned int idx) const { return masks[border[idx]]; }
+	/*
+	* Offsets from cell idx to its neighbours in the 8 directions (only meaningful where mask() is set)
+	*/
+	const int* offsets(unsigned int idx) const { return table[border[idx]]; }
+	/*
+	* Writes the indices of the 8 neighbours of idx to indices[0..7], or -1 where there is no neighbour
+	*/
+	void neighbours(unsigned int idx, unsigned int* indices) const
+	{
+		uint8_t valid = mask(idx);
+		const int* off = offsets(idx);
+		for(unsigned int dir = 0; dir < 8; dir++) { indices[dir] = (valid >> dir & 1) ? idx + off[dir] : (unsigned int)-1; }
+	}
+
+	size_t get_dim_x() const { return dim_x; }
+	size_t get_dim_y() const { return dim_y; }
+	bool wraps() const { return wrap; }
+private:
+	size_t dim_x;
+	size_t dim_y;
+	bool wrap;
+	int table[16][8];
+	uint8_t masks[16];
+	std::vector<uint8_t> border; // Border class of every cell
+};
+
+#endif
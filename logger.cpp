@@ -0,0 +1,150 @@
+#include "logger.hpp"
+#include <iostream>
+#include <chrono>
+
+namespace
+{
+	std::shared_ptr<LogSink>& sink_instance()
+	{
+		static std::shared_ptr<LogSink> sink = std::make_shared<StreamSink>(std::cout);
+		return sink;
+	}
+
+	std::atomic<int>& level_instance()
+	{
+		static std::atomic<int> level((int)LogLevel::info);
+		return level;
+	}
+}
+
+const char* log_level_name(LogLevel level)
+{
+	static const char* names[] = {"trace","debug","info","warning","error","off"};
+	return names[(int)level];
+}
+
+void StreamSink::write(LogLevel level, const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	os << "[" << log_level_name(level) << "] " << message << '\n';
+}
+
+void StreamSink::flush()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	os.flush();
+}
+
+BufferedSink::BufferedSink(std::shared_ptr<LogSink> target, size_t capacity) : target(target) , head(0) , tail(0) , n_dropped(0) , stop(false)
+{
+	size_t size = 2;
+	while(size < capacity) { size *= 2; }
+	mask = size - 1;
+	slots.reset(new Slot[size]);
+	for(size_t i = 0; i < size; i++) { slots[i].sequence.store(i,std::memory_order_relaxed); }
+	thread = std::thread(&BufferedSink::drain,this);
+}
+
+BufferedSink::~BufferedSink()
+{
+	stop.store(true,std::memory_order_release);
+	thread.join();
+}
+
+void BufferedSink::write(LogLevel level, const std::string& message)
+{
+	// Claim a slot: its sequence equals pos while it is free for the pos-th message
+	size_t pos = head.load(std::memory_order_relaxed);
+	Slot* slot;
+	while(true)
+	{
+		slot = &slots[pos & mask];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if(sequence == pos)
+		{
+			if(head.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed)) { break; }
+		}
+		else if(sequence < pos)
+		{
+			// The slot still holds the message of the previous round: the buffer is full
+			n_dropped.fetch_add(1,std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+	slot->level = level;
+	slot->message.assign(message); // Reuses the capacity left by earlier messages
+	slot->sequence.store(pos + 1,std::memory_order_release);
+}
+
+bool BufferedSink::pop(LogLevel& level, std::string& message)
+{
+	size_t pos = tail.load(std::memory_order_relaxed);
+	Slot& slot = slots[pos & mask];
+	if(slot.sequence.load(std::memory_order_acquire) != pos + 1) { return false; } // Empty, or not published yet
+	level = slot.level;
+	message.swap(slot.message);
+	slot.sequence.store(pos + mask + 1,std::memory_order_release); // Free for the next round
+	tail.store(pos + 1,std::memory_order_release);
+	return true;
+}
+
+void BufferedSink::drain()
+{
+	LogLevel level;
+	std::string message;
+	while(true)
+	{
+		bool stopping = stop.load(std::memory_order_acquire);
+		bool any = false;
+		while(pop(level,message))
+		{
+			if(target) { target->write(level,message); }
+			any = true;
+		}
+		if(stopping) { break; }
+		if(!any) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+	}
+	if(target) { target->flush(); }
+}
+
+void BufferedSink::flush()
+{
+	size_t end = head.load(std::memory_order_acquire);
+	while(tail.load(std::memory_order_acquire) < end) { std::this_thread::sleep_for(std::chrono::microseconds(100)); }
+	if(target) { target->flush(); }
+}
+
+void set_log_sink(std::shared_ptr<LogSink> sink)
+{
+	std::atomic_store(&sink_instance(),sink);
+}
+
+std::shared_ptr<LogSink> get_log_sink()
+{
+	return std::atomic_load(&sink_instance());
+}
+
+void set_log_level(LogLevel level)
+{
+	level_instance().store((int)level,std::memory_order_relaxed);
+}
+
+LogLevel get_log_level()
+{
+	return (LogLevel)level_instance().load(std::memory_order_relaxed);
+}
+
+bool log_enabled(LogLevel level)
+{
+	return level != LogLevel::off && (int)level >= level_instance().load(std::memory_order_relaxed);
+}
+
+void log_message(LogLevel level, const std::string& message)
+{
+	std::shared_ptr<LogSink> sink = get_log_sink();
+	if(sink) { sink->write(level,message); }
+}
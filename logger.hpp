@@ -0,0 +1,132 @@
+#ifndef STRATEGY_LOGGER_H
+#define STRATEGY_LOGGER_H
+#include <string>
+#include <sstream>
+#include <ostream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+/*
+Logging
+	Description
+		Leveled log messages of the generator, written to a replaceable LogSink (set_log_sink).
+		Levels below WFC_LOG_LEVEL (default: info) are removed at compile time, so the debug messages of the
+		solver (map started/finished, every contradiction and restart) cost nothing unless the library is
+		built with e.g. -DWFC_LOG_LEVEL=0. Above that, set_log_level filters at run time.
+		The default sink writes info and above to std::cout, one line per message without flushing.
+		BufferedSink decouples the caller from the output: messages go into a lock-free ring buffer and a
+		background thread writes them to another sink, so logging threads never wait for I/O or for each other.
+		When the buffer is full, messages are dropped and counted instead of blocking.
+
+	Example use case:
+		set_log_sink(std::make_shared<BufferedSink>(std::make_shared<StreamSink>(std::cerr)));
+		set_log_level(LogLevel::warning);
+		WFC_LOG(LogLevel::info,"Loaded " << n << " chunks");
+*/
+enum class LogLevel { trace, debug, info, warning, error, off };
+
+#ifndef WFC_LOG_LEVEL
+#define WFC_LOG_LEVEL 2 // LogLevel::info
+#endif
+
+const char* log_level_name(LogLevel level);
+
+class LogSink
+{
+public:
+	virtual ~LogSink() {}
+	/*
+	* Called for every message that passes the level filters, possibly from several threads at once
+	*/
+	virtual void write(LogLevel level, const std::string& message) = 0;
+	/*
+	* Returns when all messages written so far have reached their destination
+	*/
+	virtual void flush() {}
+};
+
+/*
+* Writes "[level] message" lines to a stream, serialized by a mutex
+*/
+class StreamSink : public LogSink
+{
+public:
+	explicit StreamSink(std::ostream& os) : os(os) {}
+	void write(LogLevel level, const std::string& message);
+	void flush();
+private:
+	std::ostream& os;
+	std::mutex mutex;
+};
+
+/*
+* Bounded multi-producer queue (one sequence number per slot, Vyukov style) drained by a background thread into target
+*/
+class BufferedSink : public LogSink
+{
+public:
+	/*
+	* capacity is rounded up to a power of two
+	*/
+	explicit BufferedSink(std::shared_ptr<LogSink> target, size_t capacity = 4096);
+	/*
+	* Writes the remaining messages and stops the thread
+	*/
+	~BufferedSink();
+	void write(LogLevel level, const std::string& message);
+	void flush();
+	/*
+	* Messages lost because the buffer was full
+	*/
+	size_t dropped() const { return n_dropped.load(std::memory_order_relaxed); }
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		LogLevel level;
+		std::string message;
+	};
+	void drain();
+	bool pop(LogLevel& level, std::string& message);
+
+	std::shared_ptr<LogSink> target;
+	std::unique_ptr<Slot[]> slots;
+	size_t mask; // capacity - 1
+	std::atomic<size_t> head; // Next slot to write
+	std::atomic<size_t> tail; // Next slot to read (only the drain thread moves it)
+	std::atomic<size_t> n_dropped;
+	std::atomic<bool> stop;
+	std::thread thread;
+};
+
+/*
+* Replaces the sink of all log messages (nullptr discards them). Thread safe.
+*/
+void set_log_sink(std::shared_ptr<LogSink> sink);
+std::shared_ptr<LogSink> get_log_sink();
+/*
+* Messages below level are discarded at run time (levels below WFC_LOG_LEVEL never reach this check)
+*/
+void set_log_level(LogLevel level);
+LogLevel get_log_level();
+bool log_enabled(LogLevel level);
+void log_message(LogLevel level, const std::string& message);
+
+/*
+* Logs the stream expression message at level, e.g. WFC_LOG(LogLevel::debug,"Restart " << n). Nothing of it,
+* including the formatting, is evaluated if the level is filtered.
+*/
+#define WFC_LOG(level,message) \
+	do { \
+		if((int)(level) >= WFC_LOG_LEVEL && log_enabled(level)) \
+		{ \
+			std::ostringstream wfc_log_stream; \
+			wfc_log_stream << message; \
+			log_message(level,wfc_log_stream.str()); \
+		} \
+	} while(0)
+
+#endif
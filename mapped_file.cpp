@@ -0,0 +1,51 @@
+#include "mapped_file.hpp"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string& filename) : begin(nullptr) , length(0) , mapped(false)
+{
+#ifdef MAPPED_FILE_MMAP
+	int fd = open(filename.c_str(),O_RDONLY);
+	if(fd < 0) { throw std::runtime_error("MappedFile: cannot open " + filename); }
+	struct stat st;
+	if(fstat(fd,&st) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("MappedFile: cannot stat " + filename);
+	}
+	length = st.st_size;
+	if(length > 0) // mmap does not accept empty mappings
+	{
+		void* addr = mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+		if(addr != MAP_FAILED)
+		{
+			madvise(addr,length,MADV_SEQUENTIAL);
+			begin = static_cast<const char*>(addr);
+			mapped = true;
+		}
+	}
+	close(fd);
+	if(mapped || length == 0) { return; }
+	// Not mappable (e.g. a pipe): fall back to reading the file
+#endif
+	std::ifstream ifs(filename,std::ifstream::in | std::ifstream::binary);
+	if(!ifs) { throw std::runtime_error("MappedFile: cannot open " + filename); }
+	buffer.assign(std::istreambuf_iterator<char>(ifs),std::istreambuf_iterator<char>());
+	begin = buffer.data();
+	length = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef MAPPED_FILE_MMAP
+	if(mapped) { munmap(const_cast<char*>(begin),length); }
+#endif
+}
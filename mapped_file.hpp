@@ -0,0 +1,36 @@
+#ifndef STRATEGY_MAPPED_FILE_H
+#define STRATEGY_MAPPED_FILE_H
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*
+MappedFile
+	Description
+		Read-only view of the whole contents of a file. On POSIX systems the file is memory-mapped, so opening it
+		does not copy anything and pages are read in by the OS as they are touched. Elsewhere the file is read
+		into a buffer once. The view stays valid until the MappedFile is destroyed.
+		Throws std::runtime_error if the file cannot be opened.
+
+	Example use case:
+		MappedFile file("Maps/input_map.txt");
+		size_t rows = std::count(file.data(), file.data() + file.size(), '\n');
+*/
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return begin; }
+	size_t size() const { return length; }
+private:
+	const char* begin;
+	size_t length;
+	bool mapped; // true: begin was returned by mmap, false: begin points into buffer
+	std::vector<char> buffer;
+};
+
+#endif
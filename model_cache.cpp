@@ -0,0 +1,270 @@
+#include "wfc.hpp"
+#include "mapped_file.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+* Compiled model file: "WFCC", uint32 version, uint64 byte order marker, uint64 cache key, then the fields of
+* WFCModel in declaration order. Numbers are stored in the byte order of the machine that wrote the file (checked
+* through the marker), arrays as a uint64 length followed by the elements, padded to 8 bytes.
+*/
+static const char compiled_magic[4] = {'W','F','C','C'};
+static const uint32_t compiled_version = 1;
+static const uint64_t byte_order = 0x0102030405060708ULL;
+
+namespace
+{
+	class CompiledWriter
+	{
+	public:
+		template <typename T> void value(T v) { bytes(&v,sizeof(T)); }
+		void bytes(const void* data, size_t n)
+		{
+			const char* p = static_cast<const char*>(data);
+			out.insert(out.end(),p,p + n);
+			out.resize((out.size() + 7)/8*8,0);
+		}
+		template <typename Vector> void array(const Vector& v)
+		{
+			value<uint64_t>(v.size());
+			bytes(v.data(),v.size()*sizeof(v[0]));
+		}
+		void string(const std::string& s) { array(s); }
+
+		std::vector<char> out;
+	};
+
+	class CompiledReader
+	{
+	public:
+		CompiledReader(const char* data, size_t size) : p(data), end(data + size) {}
+		template <typename T> T value() { T v; bytes(&v,sizeof(T)); return v; }
+		void bytes(void* data, size_t n)
+		{
+			size_t padded = (n + 7)/8*8;
+			if((size_t)(end - p) < padded) { throw std::runtime_error("WFCModel::load: truncated model file"); }
+			std::memcpy(data,p,n);
+			p += padded;
+		}
+		template <typename Vector> void array(Vector& v)
+		{
+			uint64_t n = value<uint64_t>();
+			if(n > (uint64_t)(end - p)/sizeof(v[0])) { throw std::runtime_error("WFCModel::load: truncated model file"); }
+			v.resize(n);
+			if(n > 0) { bytes(&v[0],n*sizeof(v[0])); }
+		}
+		std::string string() { std::string s; array(s); return s; }
+	private:
+		const char* p;
+		const char* end;
+	};
+}
+
+// FNV-1a step over n bytes
+static void fnv1a_bytes(uint64_t& hash, const void* data, size_t n)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for(size_t i = 0; i < n; i++) { hash = (hash ^ p[i])*0x100000001b3ULL; }
+}
+
+uint64_t WFCModel::cache_key(std::string filename, ModelOptions options)
+{
+	MappedFile file(filename);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	fnv1a_bytes(hash,file.data(),file.size());
+	uint64_t fields[5] = {compiled_version,(uint64_t)options.learning,options.pattern_size,options.symmetry,options.periodic_input};
+	for(uint64_t field : fields)
+	{
+		for(int i = 0; i < 8; i++) { unsigned char b = field >> (8*i); fnv1a_bytes(hash,&b,1); }
+	}
+	return hash;
+}
+
+void WFCModel::save(std::string filename, uint64_t key) const
+{
+	CompiledWriter w;
+	w.bytes(compiled_magic,4);
+	w.value(compiled_version);
+	w.value(byte_order);
+	w.value(key);
+	w.string(m_filename);
+	w.value<uint64_t>(input_sample.get_width());
+	w.value<uint64_t>(input_sample.get_height());
+	w.array(input_sample.get_ids());
+	w.value<uint64_t>(tile_types.size());
+	for(const std::string& type : tile_types) { w.string(type); }
+	w.array(freq_vector);
+	w.array(neig_probs);
+	w.array(log_neig_probs);
+	w.value<uint64_t>(neig_stride);
+	w.array(adjacency);
+	w.value<uint64_t>(adjacency_words);
+	w.array(compatible);
+	w.array(compatible_offsets);
+	w.array(tile_masks);
+	w.value<uint32_t>((uint32_t)model_options.learning);
+	w.value<uint64_t>(model_options.pattern_size);
+	w.value<uint8_t>(model_options.symmetry);
+	w.value<uint8_t>(model_options.periodic_input);
+	w.array(pattern_weights);
+	w.array(pattern_tiles);
+	w.value(model_hash);
+	// Written to a temporary file of this writer only (in the same directory, so that rename is atomic) and renamed,
+	// so that workers which miss the cache at the same time never write into a file another one has already renamed
+	// and others may be loading. The name is unique per process, thread and call; O_EXCL refuses any existing file.
+	static std::atomic<uint64_t> n_saved(0);
+	uint64_t unique = Xoshiro256::split(Xoshiro256::split((uint64_t)getpid(),std::hash<std::thread::id>()(std::this_thread::get_id())),n_saved++);
+	char suffix[32];
+	std::snprintf(suffix,sizeof(suffix),".tmp.%016llx",(unsigned long long)unique);
+	std::string temporary = filename + suffix;
+	int fd = ::open(temporary.c_str(),O_WRONLY | O_CREAT | O_EXCL,0666);
+	if(fd < 0) { throw std::runtime_error("WFCModel::save: cannot create " + temporary); }
+	size_t written = 0;
+	while(written < w.out.size())
+	{
+		ssize_t n = ::write(fd,w.out.data() + written,w.out.size() - written);
+		if(n < 0 && errno == EINTR) { continue; }
+		if(n <= 0) { break; }
+		written += n;
+	}
+	bool ok = written == w.out.size();
+	ok = ::close(fd) == 0 && ok;
+	if(!ok || std::rename(temporary.c_str(),filename.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("WFCModel::save: cannot write " + filename);
+	}
+}
+
+static void corrupt_model(const std::string& filename, const char* what)
+{
+	throw std::runtime_error(std::string("WFCModel::load: corrupt ") + what + " in " + filename);
+}
+
+std::shared_ptr<const WFCModel> WFCModel::load(std::string filename, uint64_t key)
+{
+	MappedFile file(filename);
+	CompiledReader r(file.data(),file.size());
+	char magic[4];
+	r.bytes(magic,4);
+	if(std::memcmp(magic,compiled_magic,4) != 0) { throw std::runtime_error("WFCModel::load: " + filename + " is not a compiled model"); }
+	if(r.value<uint32_t>() != compiled_version) { throw std::runtime_error("WFCModel::load: unsupported version in " + filename); }
+	if(r.value<uint64_t>() != byte_order) { throw std::runtime_error("WFCModel::load: " + filename + " was written on a machine with another byte order"); }
+	if(r.value<uint64_t>() != key && key != 0) { throw std::runtime_error("WFCModel::load: " + filename + " was compiled from another sample"); }
+	std::shared_ptr<WFCModel> model(new WFCModel());
+	model->m_filename = r.string();
+	uint64_t width = r.value<uint64_t>(), height = r.value<uint64_t>();
+	std::vector<tile_id> ids;
+	r.array(ids);
+	uint64_t n_types = r.value<uint64_t>();
+	// Tile ids must fit tile_id below WFCSolver::free_cell, and StringMap interning would merge repeated names
+	if(n_types >= WFCSolver::free_cell) { corrupt_model(filename,"number of tile types"); }
+	for(uint64_t i = 0; i < n_types; i++) { model->tile_types.push_back(r.string()); }
+	if(width != 0 && height > std::numeric_limits<uint64_t>::max()/width) { corrupt_model(filename,"input sample size"); }
+	if(ids.size() != width*height) { corrupt_model(filename,"input sample"); }
+	for(tile_id id : ids)
+	{
+		if(id >= n_types) { corrupt_model(filename,"input sample tile id"); }
+	}
+	model->input_sample = StringMap(width,height,model->tile_types);
+	if(model->input_sample.get_types().size() != n_types) { corrupt_model(filename,"tile type names"); }
+	for(tile_id id : ids) { model->input_sample.push_back(id); }
+	r.array(model->freq_vector);
+	r.array(model->neig_probs);
+	r.array(model->log_neig_probs);
+	model->neig_stride = r.value<uint64_t>();
+	r.array(model->adjacency);
+	model->adjacency_words = r.value<uint64_t>();
+	r.array(model->compatible);
+	r.array(model->compatible_offsets);
+	r.array(model->tile_masks);
+	uint32_t learning = r.value<uint32_t>();
+	if(learning > (uint32_t)LearningMode::overlapping) { corrupt_model(filename,"learning mode"); }
+	model->model_options.learning = (LearningMode)learning;
+	model->model_options.pattern_size = r.value<uint64_t>();
+	model->model_options.symmetry = r.value<uint8_t>() != 0;
+	model->model_options.periodic_input = r.value<uint8_t>() != 0;
+	r.array(model->pattern_weights);
+	r.array(model->pattern_tiles);
+	model->model_hash = r.value<uint64_t>();
+	// Everything the accessors and the solver index with. A damaged or stale file must throw (and be learned again
+	// by cached), not read out of bounds.
+	bool overlapping = model->model_options.learning == LearningMode::overlapping;
+	if(model->freq_vector.size() != n_types) { corrupt_model(filename,"frequencies"); }
+	if(overlapping)
+	{
+		// Patterns are n*n tiles: at least 2x2 and, unless the input wraps around, no larger than the sample
+		size_t n = model->model_options.pattern_size;
+		if(n < 2 || n > 256 || (!model->model_options.periodic_input && (n > width || n > height)))
+		{
+			corrupt_model(filename,"pattern size");
+		}
+		if(model->pattern_tiles.size() != model->pattern_weights.size()) { corrupt_model(filename,"patterns"); }
+		for(tile_id tile : model->pattern_tiles)
+		{
+			if(tile >= n_types) { corrupt_model(filename,"pattern tile id"); }
+		}
+	}
+	else
+	{
+		if(model->neig_stride < n_types || model->neig_stride > n_types + WaveFunction::alignment/sizeof(double)
+			|| model->neig_probs.size() != n_types*8*model->neig_stride)
+		{
+			corrupt_model(filename,"neighbour probabilities");
+		}
+	}
+	if(model->neig_probs.size() != model->log_neig_probs.size()) { corrupt_model(filename,"neighbour probabilities"); }
+	size_t n_patterns = model->get_n_patterns();
+	if(model->adjacency_words != (n_patterns + 63)/64 || model->adjacency.size() != n_patterns*8*model->adjacency_words)
+	{
+		corrupt_model(filename,"adjacency");
+	}
+	if(model->tile_masks.size() != n_types*model->adjacency_words) { corrupt_model(filename,"tile masks"); }
+	const std::vector<size_t>& offsets = model->compatible_offsets;
+	if(offsets.size() != n_patterns*8 + 1 || offsets.front() != 0 || offsets.back() != model->compatible.size())
+	{
+		corrupt_model(filename,"compatible lists");
+	}
+	for(size_t i = 1; i < offsets.size(); i++)
+	{
+		if(offsets[i] < offsets[i - 1]) { corrupt_model(filename,"compatible lists"); }
+	}
+	for(unsigned int p : model->compatible)
+	{
+		if(p >= n_patterns) { corrupt_model(filename,"compatible pattern"); }
+	}
+	// The float rows are derived, not saved
+	if(model->model_options.learning == LearningMode::adjacent) { model->calculate_neigs_float(); }
+	return model;
+}
+
+std::shared_ptr<const WFCModel> WFCModel::cached(std::string filename, std::string cache_dir, ModelOptions options)
+{
+	uint64_t key = cache_key(filename,options);
+	char name[32];
+	std::snprintf(name,sizeof(name),"%016llx.wfcc",(unsigned long long)key);
+	std::string path = cache_dir + "/" + name;
+	try
+	{
+		return load(path,key);
+	}
+	catch(std::runtime_error&)
+	{
+		// Not compiled yet (or unreadable): learn the model and compile it for the next time
+	}
+	std::shared_ptr<const WFCModel> model = std::make_shared<WFCModel>(filename,options);
+	try
+	{
+		model->save(path,key);
+	}
+	catch(std::runtime_error& e)
+	{
+		WFC_LOG(LogLevel::warning,"Caching the model failed: " << e.what());
+	}
+	return model;
+}
@@ -0,0 +1,88 @@
+#include "patterns.hpp"
+#include <unordered_map>
+#include <stdexcept>
+
+namespace
+{
+	// FNV-1a over the tile ids of a pattern (or of the overlapping part of one)
+	struct TilesHash
+	{
+		size_t operator()(const std::vector<tile_id>& key) const
+		{
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			for(tile_id id : key) { hash = (hash ^ id)*0x100000001b3ULL; }
+			return (size_t)hash;
+		}
+	};
+	typedef std::unordered_map<std::vector<tile_id>,unsigned int,TilesHash> PatternIndex;
+}
+
+Patterns::Patterns(const StringMap& sample, size_t n, bool symmetry, bool periodic_input) : n(n)
+{
+	if(n < 2) { throw std::invalid_argument("Patterns: pattern size < 2"); }
+	size_t width = sample.get_width(), height = sample.get_height();
+	size_t max_x = periodic_input ? width : (width >= n ? width - n + 1 : 0);
+	size_t max_y = periodic_input ? height : (height >= n ? height - n + 1 : 0);
+	if(max_x == 0 || max_y == 0) { throw std::invalid_argument("Patterns: input sample smaller than the pattern size"); }
+	PatternIndex index;
+	std::vector<tile_id> window(n*n), variant(n*n);
+	for(size_t y0 = 0; y0 < max_y; y0++)
+	{
+		for(size_t x0 = 0; x0 < max_x; x0++)
+		{
+			for(size_t y = 0; y < n; y++)
+			{
+				for(size_t x = 0; x < n; x++) { window[y*n + x] = sample.get_id(((y0 + y) % height)*width + (x0 + x) % width); }
+			}
+			// The window itself, then its 3 rotations and the reflections of all 4
+			for(unsigned int v = 0; v < (symmetry ? 8u : 1u); v++)
+			{
+				for(size_t y = 0; y < n; y++)
+				{
+					for(size_t x = 0; x < n; x++)
+					{
+						size_t sx = x, sy = y;
+						for(unsigned int r = 0; r < v % 4; r++) { size_t t = sx; sx = n - 1 - sy; sy = t; } // Rotate by 90 degrees
+						if(v >= 4) { sx = n - 1 - sx; } // Reflect
+						variant[y*n + x] = window[sy*n + sx];
+					}
+				}
+				PatternIndex::const_iterator it = index.find(variant);
+				if(it != index.end()) { counts[it->second]++; continue; }
+				index.insert(std::make_pair(variant,(unsigned int)counts.size()));
+				tiles.insert(tiles.end(),variant.begin(),variant.end());
+				counts.push_back(1);
+			}
+		}
+	}
+	calculate_compatibility();
+}
+
+void Patterns::calculate_compatibility()
+{
+	static const int dx[8] = {-1,-1,0,1,1,1,0,-1};
+	static const int dy[8] = {0,-1,-1,-1,0,1,1,1};
+	compatibility.assign(size()*8,std::vector<unsigned int>());
+	std::vector<tile_id> key;
+	for(unsigned int dir = 0; dir < 8; dir++)
+	{
+		// The neighbour q sits at (dx,dy) relative to p. In p's coordinates they overlap on x in [x0,x1), y in [y0,y1).
+		int x0 = std::max(0,dx[dir]), x1 = std::min((int)n,(int)n + dx[dir]);
+		int y0 = std::max(0,dy[dir]), y1 = std::min((int)n,(int)n + dy[dir]);
+		// Group the patterns by the part that must match when they are the neighbour
+		std::unordered_map<std::vector<tile_id>,std::vector<unsigned int>,TilesHash> groups;
+		for(unsigned int q = 0; q < size(); q++)
+		{
+			key.clear();
+			for(int y = y0; y < y1; y++) { for(int x = x0; x < x1; x++) { key.push_back(tile(q,x - dx[dir],y - dy[dir])); } }
+			groups[key].push_back(q);
+		}
+		for(unsigned int p = 0; p < size(); p++)
+		{
+			key.clear();
+			for(int y = y0; y < y1; y++) { for(int x = x0; x < x1; x++) { key.push_back(tile(p,x,y)); } }
+			std::unordered_map<std::vector<tile_id>,std::vector<unsigned int>,TilesHash>::const_iterator it = groups.find(key);
+			if(it != groups.end()) { compatibility[p*8 + dir] = it->second; }
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef STRATEGY_PATTERNS_H
+#define STRATEGY_PATTERNS_H
+#include <vector>
+#include <stdint.h>
+#include "wfc.hpp"
+
+/*
+Patterns
+	Description
+		The distinct n x n patterns of tiles of an input sample, as used by the overlapping model
+		(LearningMode::overlapping). Every n x n window of the sample is a pattern, optionally with its
+		rotations and reflections (symmetry), and with windows that wrap around the sample border
+		(periodic_input). Equal patterns are merged through a hash table and counted.
+		Two patterns are compatible in a direction (0-7, clock-wise from W like neig_probs) if the second one,
+		shifted by one cell in that direction, agrees with the first one on all tiles they overlap.
+		The compatibility lists are built by grouping the patterns by their overlapping part, so building
+		them costs the size of the lists instead of comparing all pairs of patterns.
+
+	Example use case:
+		Patterns patterns(sample,3,true,false);
+		for(unsigned int q : patterns.compatible(p,4)) { ... } // q may be east of p
+*/
+class Patterns
+{
+public:
+	Patterns(const StringMap& sample, size_t n, bool symmetry, bool periodic_input);
+	/*
+	* Number of distinct patterns
+	*/
+	size_t size() const { return counts.size(); }
+	size_t get_n() const { return n; }
+	/*
+	* Tile at (x,y) of pattern p
+	*/
+	tile_id tile(unsigned int p, size_t x, size_t y) const { return tiles[(p*n + y)*n + x]; }
+	/*
+	* How often pattern p occurs in the sample (all variants counted)
+	*/
+	size_t count(unsigned int p) const { return counts[p]; }
+	/*
+	* Patterns (ascending) that may be the neighbour of p in direction dir
+	*/
+	const std::vector<unsigned int>& compatible(unsigned int p, unsigned int dir) const { return compatibility[p*8 + dir]; }
+private:
+	void calculate_compatibility();
+
+	size_t n;
+	std::vector<tile_id> tiles; // [pattern][y][x]
+	std::vector<size_t> counts;
+	std::vector<std::vector<unsigned int>> compatibility; // [pattern][direction]
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "profiler.hpp"
+#include "wfc.hpp"
+#include <sstream>
+#include <iomanip>
+
+const char* profile_phase_name(ProfilePhase phase)
+{
+	static const char* names[(int)ProfilePhase::count] = {"generate","select","collapse","propagate","entropy","contradiction","output"};
+	return names[(int)phase];
+}
+
+GenerationStats WFCSolver::get_generation_stats() const
+{
+	GenerationStats s;
+	s.dim_x = last_dim_x;
+	s.dim_y = last_dim_y;
+	s.seed = seed;
+	s.propagation = stats;
+#ifdef WFC_PROFILE
+	s.profiled = true;
+	s.entropy_updates = profiler.entropy_updates;
+	for(int p = 0; p < (int)ProfilePhase::count; p++) { s.phases[p] = profiler.phases[p]; }
+	s.trace = profiler.events;
+#endif
+	return s;
+}
+
+std::string GenerationStats::to_json() const
+{
+	std::ostringstream os;
+	os << std::setprecision(9);
+	os << "{\"dim_x\": " << dim_x << ", \"dim_y\": " << dim_y << ", \"seed\": " << seed;
+	os << ", \"collapses\": " << propagation.collapses << ", \"propagation_steps\": " << propagation.steps << ", \"max_steps\": " << propagation.max_steps;
+	os << ", \"contradictions\": " << propagation.contradictions << ", \"restarts\": " << propagation.restarts << ", \"backtracks\": " << propagation.backtracks;
+	os << ", \"profiled\": " << (profiled ? "true" : "false");
+	if(profiled)
+	{
+		os << ", \"entropy_updates\": " << entropy_updates << ", \"phases\": {";
+		for(int p = 0; p < (int)ProfilePhase::count; p++)
+		{
+			os << (p == 0 ? "" : ", ") << "\"" << profile_phase_name((ProfilePhase)p) << "\": {\"calls\": " << phases[p].calls << ", \"seconds\": " << phases[p].seconds << "}";
+		}
+		os << "}";
+	}
+	os << "}";
+	return os.str();
+}
+
+void GenerationStats::write_chrome_trace(std::ostream& os, unsigned int tid) const
+{
+	// Complete events ("ph": "X") with timestamps in microseconds. The caller's formatting is restored afterwards.
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+	os << std::fixed << std::setprecision(3);
+	os << "{\"traceEvents\": [\n";
+	for(size_t i = 0; i < trace.size(); i++)
+	{
+		const TraceEvent& e = trace[i];
+		os << (i == 0 ? "" : ",\n") << "{\"name\": \"" << profile_phase_name(e.phase) << "\", \"cat\": \"wfc\", \"ph\": \"X\", \"ts\": " << e.start_ns*1e-3
+			<< ", \"dur\": " << e.duration_ns*1e-3 << ", \"pid\": 0, \"tid\": " << tid << "}";
+	}
+	os << "\n], \"displayTimeUnit\": \"ns\"}\n";
+	os.flags(flags);
+	os.precision(precision);
+}
@@ -0,0 +1,110 @@
+#ifndef STRATEGY_PROFILER_H
+#define STRATEGY_PROFILER_H
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+/*
+Profiler
+	Description
+		Opt-in instrumentation of WFCSolver::generate_map. Compiled in only with WFC_PROFILE defined
+		(cmake -DWFC_PROFILING=ON): without it, WFC_PROFILE_SCOPE and WFC_PROFILE_COUNT expand to nothing and
+		WFCSolver has no Profiler member, so the solver carries no timers, no counters and no branches for them.
+		Every phase (see ProfilePhase) has a call count and the total seconds spent in it. Phases nest (propagate
+		runs inside collapse), so their times are inclusive and do not add up to the total.
+		With tracing on, every timed scope is also recorded as an event, for chrome://tracing or Perfetto
+		(GenerationStats::write_chrome_trace). A 256x256 map records a few hundred thousand events.
+
+	Example use case:
+		void WFCSolver::propagate(...)
+		{
+			WFC_PROFILE_SCOPE(profiler,ProfilePhase::propagate);
+			...
+			WFC_PROFILE_COUNT(profiler,entropy_updates);
+		}
+*/
+enum class ProfilePhase { generate, select, collapse, propagate, entropy, contradiction, output, count };
+
+/*
+* Name of phase in JSON and trace output
+*/
+const char* profile_phase_name(ProfilePhase phase);
+
+struct PhaseStats
+{
+	size_t calls;
+	double seconds; // Inclusive of nested phases
+	PhaseStats() : calls(0), seconds(0) {}
+};
+
+struct TraceEvent
+{
+	ProfilePhase phase;
+	uint64_t start_ns; // Since the start of generate_map
+	uint64_t duration_ns;
+};
+
+class Profiler
+{
+public:
+	Profiler() : tracing(false), entropy_updates(0) {}
+	/*
+	* Clears the counters for the next map. With trace, timed scopes are also recorded as TraceEvents.
+	*/
+	void reset(bool trace)
+	{
+		tracing = trace;
+		for(PhaseStats& p : phases) { p = PhaseStats(); }
+		events.clear();
+		entropy_updates = 0;
+		origin = std::chrono::steady_clock::now();
+	}
+	void add(ProfilePhase phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+	{
+		std::chrono::nanoseconds duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+		PhaseStats& p = phases[(int)phase];
+		p.calls++;
+		p.seconds += duration.count()*1e-9;
+		if(!tracing) { return; }
+		TraceEvent event;
+		event.phase = phase;
+		event.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+		event.duration_ns = duration.count();
+		events.push_back(event);
+	}
+
+	bool tracing;
+	PhaseStats phases[(int)ProfilePhase::count];
+	std::vector<TraceEvent> events;
+	size_t entropy_updates; // Entropy recomputations of queued cells
+	std::chrono::steady_clock::time_point origin;
+};
+
+/*
+* Times the enclosing scope as phase
+*/
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler& profiler, ProfilePhase phase) : profiler(profiler), phase(phase), start(std::chrono::steady_clock::now()) {}
+	~ProfileScope() { profiler.add(phase,start,std::chrono::steady_clock::now()); }
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+private:
+	Profiler& profiler;
+	ProfilePhase phase;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define WFC_PROFILE_CONCAT2(a,b) a##b
+#define WFC_PROFILE_CONCAT(a,b) WFC_PROFILE_CONCAT2(a,b)
+#ifdef WFC_PROFILE
+#define WFC_PROFILE_SCOPE(profiler,phase) ProfileScope WFC_PROFILE_CONCAT(profile_scope_,__LINE__)(profiler,phase)
+#define WFC_PROFILE_COUNT(profiler,counter) ((profiler).counter++)
+#else
+#define WFC_PROFILE_SCOPE(profiler,phase) ((void)0)
+#define WFC_PROFILE_COUNT(profiler,counter) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef STRATEGY_RANDOM_H
+#define STRATEGY_RANDOM_H
+#include <stdint.h>
+
+/*
+Xoshiro256
+	Description
+		xoshiro256** pseudo random number generator (Blackman & Vigna), seeded through splitmix64.
+		Unlike std::default_random_engine and the std:: distributions, both the generator and the
+		conversions to doubles and bounded integers are fully specified here, so a seed gives the same
+		numbers with every compiler, standard library and platform.
+
+	Example use case:
+		Xoshiro256 rng(42);
+		double r = rng.uniform(); // [0,1)
+		uint64_t i = rng.below(10); // 0..9
+		uint64_t seed_7 = Xoshiro256::split(42,7); // Independent seed for the 7th map of a batch
+*/
+class Xoshiro256
+{
+public:
+	explicit Xoshiro256(uint64_t seed)
+	{
+		for(int i = 0; i < 4; i++) { s[i] = splitmix64(seed); }
+	}
+	uint64_t next()
+	{
+		uint64_t result = rotl(s[1]*5,7)*9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3],45);
+		return result;
+	}
+	/*
+	* Uniform double in [0,1) from the upper 53 bits
+	*/
+	double uniform() { return (next() >> 11)*(1.0/9007199254740992.0); }
+	/*
+	* Uniform integer in [0,n) without modulo bias (Lemire's multiply-shift with rejection). n must be > 0.
+	*/
+	uint64_t below(uint64_t n)
+	{
+		if(n <= 1) { return 0; }
+		uint64_t threshold = (0 - n) % n;
+		while(true)
+		{
+			uint64_t x = next();
+			uint64_t high, low;
+			multiply(x,n,high,low);
+			if(low >= threshold) { return high; }
+		}
+	}
+	/*
+	* Derives the seed of stream index from seed, e.g. of map index of a batch
+	*/
+	static uint64_t split(uint64_t seed, uint64_t index)
+	{
+		uint64_t state = seed ^ (index*0xD1B54A32D192ED03ULL);
+		return splitmix64(state);
+	}
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	static uint64_t splitmix64(uint64_t& state)
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+	// 128 bit product of a and b, from 32 bit halves (no __int128 in portable C++11)
+	static void multiply(uint64_t a, uint64_t b, uint64_t& high, uint64_t& low)
+	{
+		uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+		uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+		uint64_t lo_lo = a_lo*b_lo, hi_lo = a_hi*b_lo, lo_hi = a_lo*b_hi, hi_hi = a_hi*b_hi;
+		uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+		high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+		low = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+	}
+
+	uint64_t s[4];
+};
+
+#endif
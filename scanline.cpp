@@ -0,0 +1,148 @@
+#include "wfc.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+/*
+* Cell (x,y) at position d of the Hilbert curve that fills a side x side square (side a power of two)
+*/
+static void hilbert_cell(size_t side, size_t d, size_t& x, size_t& y)
+{
+	x = 0; y = 0;
+	for(size_t s = 1; s < side; s *= 2)
+	{
+		size_t rx = 1 & (d/2);
+		size_t ry = 1 & (d ^ rx);
+		// Rotate the quadrant
+		if(ry == 0)
+		{
+			if(rx == 1) { x = s - 1 - x; y = s - 1 - y; }
+			std::swap(x,y);
+		}
+		x += s*rx;
+		y += s*ry;
+		d /= 4;
+	}
+}
+
+bool WFCSolver::start_scanline()
+{
+	size_t n_cells = last_dim_x*last_dim_y;
+	unsigned int n_patterns = model->get_n_patterns();
+	grid.reset(last_dim_x,last_dim_y,options.wrap);
+	scan_types.assign(n_cells,n_patterns);
+	scan_weights.resize(n_patterns);
+	allowed.resize(model->get_adjacency_words());
+	scan_pos = 0;
+	scan_set = 0;
+	// Hilbert curve over the smallest power of two square that covers the map
+	scan_side = 1;
+	while(scan_side < last_dim_x || scan_side < last_dim_y) { scan_side *= 2; }
+	// Given cells are set up front, so that the cells before them are conditioned on them as well
+	for(size_t i = 0; i < fixed_cells.size(); i++)
+	{
+		if(fixed_cells[i] == free_cell) { continue; }
+		if(fixed_cells[i] >= model->get_n_types()) { throw std::out_of_range("generate_map: fixed tile id >= number of tile types"); }
+		scan_types[i] = fixed_cells[i];
+		scan_set++;
+		if(logging) { collapse_log.push_back(CellUpdate{(unsigned int)i,fixed_cells[i]}); }
+	}
+	return true;
+}
+
+WFCSolver::AttemptState WFCSolver::advance_scanline(StepBudget& budget)
+{
+	unsigned int n_patterns = model->get_n_patterns();
+	bool hilbert = options.order == CollapseOrder::hilbert;
+	size_t end = hilbert ? scan_side*scan_side : last_dim_x*last_dim_y;
+	while(scan_pos < end)
+	{
+		unsigned int wave_idx = scan_pos++;
+		if(hilbert)
+		{
+			// Skip the cells of the curve outside of the map
+			size_t x, y;
+			hilbert_cell(scan_side,wave_idx,x,y);
+			if(x >= last_dim_x || y >= last_dim_y) { continue; }
+			wave_idx = y*last_dim_x + x;
+		}
+		if(scan_types[wave_idx] != n_patterns) { continue; } // Given
+		WFC_PROFILE_SCOPE(profiler,ProfilePhase::collapse);
+		double type = rng.uniform();
+		unsigned int type_idx = sample_scan_cell(wave_idx,0xFF,type);
+		if(type_idx == n_patterns)
+		{
+			stats.contradictions++;
+			if(!repair_contradictions) { return AttemptState::failed; }
+			WFC_LOG(LogLevel::debug,"Contradiction occured! Sampling the cell with fewer neighbours");
+			// Ignore the diagonal neighbours first (a seam of corners only), then all of them
+			type_idx = sample_scan_cell(wave_idx,0x55,type);
+			if(type_idx == n_patterns) { type_idx = sample_scan_cell(wave_idx,0,type); }
+			if(type_idx == n_patterns) { throw std::out_of_range("advance_scanline: no pattern with non-zero weight. This should never happen. Bug in code?"); }
+		}
+		scan_types[wave_idx] = type_idx;
+		scan_set++;
+		stats.collapses++;
+		if(logging) { collapse_log.push_back(CellUpdate{wave_idx,model->tile_of(type_idx)}); }
+		if(budget.spent()) { return AttemptState::running; }
+	}
+	return AttemptState::solved;
+}
+
+unsigned int WFCSolver::sample_scan_cell(unsigned int wave_idx, uint8_t directions, double type)
+{
+	unsigned int n_patterns = model->get_n_patterns();
+	const std::vector<double>& weights = model->get_weights();
+	uint8_t valid = grid.mask(wave_idx) & directions;
+	const int* offsets = grid.offsets(wave_idx);
+	if(options.mode == SolverMode::probabilistic)
+	{
+		// Product of the frequencies and the neighbour probabilities of every set neighbour
+		std::copy(weights.begin(),weights.end(),scan_weights.begin());
+		double sum = -1;
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
+		{
+			if(!(valid >> neig_i & 1)) { continue; }
+			unsigned int neig_type = scan_types[wave_idx + offsets[neig_i]];
+			if(neig_type == n_patterns) { continue; }
+			// The cell lies in the opposite direction as seen from the neighbour
+			sum = kernels->multiply(model->neig_prob(neig_type,(neig_i + 4) % 8),scan_weights.data(),n_patterns);
+		}
+		if(sum < 0) { sum = std::accumulate(weights.begin(),weights.end(),0.0); } // No neighbour set
+		if(sum <= 0) { return n_patterns; }
+		return get_type_idx(scan_weights.data(),n_patterns,type*sum);
+	}
+	// Bitset mode: intersection of the adjacency bitsets of every set neighbour
+	size_t words = allowed.size();
+	std::fill(allowed.begin(),allowed.end(),~(uint64_t)0);
+	if(n_patterns % 64 != 0) { allowed[words - 1] = ((uint64_t)1 << (n_patterns % 64)) - 1; }
+	for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
+	{
+		if(!(valid >> neig_i & 1)) { continue; }
+		unsigned int neig_type = scan_types[wave_idx + offsets[neig_i]];
+		if(neig_type == n_patterns) { continue; }
+		const uint64_t* adjacency = model->adjacency_mask(neig_type,(neig_i + 4) % 8);
+		for(size_t w = 0; w < words; w++) { allowed[w] &= adjacency[w]; }
+	}
+	// Weighted choice among the allowed patterns, like Domains::weighted_type
+	double sum = 0;
+	for(size_t w = 0; w < words; w++)
+	{
+		for(uint64_t bits = allowed[w]; bits; bits &= bits - 1) { sum += weights[w*64 + __builtin_ctzll(bits)]; }
+	}
+	if(sum <= 0) { return n_patterns; }
+	double value = type*sum, current = 0;
+	unsigned int last = n_patterns;
+	for(size_t w = 0; w < words; w++)
+	{
+		for(uint64_t bits = allowed[w]; bits; bits &= bits - 1)
+		{
+			unsigned int t = w*64 + __builtin_ctzll(bits);
+			if(weights[t] <= 0) { continue; }
+			current += weights[t];
+			if(value < current) { return t; }
+			last = t;
+		}
+	}
+	return last; // value rounded up to the sum of the weights
+}
@@ -0,0 +1,65 @@
+#include "seam_lattice.hpp"
+
+SeamLattice::SeamLattice(std::shared_ptr<const WFCModel> model, size_t cell_size, uint64_t seed) : model(model) , cell_size(cell_size) , seed(seed)
+{
+	// The tiles fixed next to the two corners of a seam must not be neighbours: nothing would check them diagonally
+	if(cell_size < 4) { throw std::invalid_argument("SeamLattice: cell_size < 4"); }
+}
+
+uint64_t SeamLattice::lattice_seed(SeedKind kind, int64_t i, int64_t j) const
+{
+	return Xoshiro256::split(Xoshiro256::split(Xoshiro256::split(seed,kind),(uint64_t)i),(uint64_t)j);
+}
+
+void SeamLattice::corner(WFCSolver& solver, int64_t i, int64_t j, std::vector<tile_id>& out) const
+{
+	if(solver.get_options().wrap) { throw std::invalid_argument("SeamLattice::corner: solver must not wrap around"); }
+	out = solver.generate_map(3,3,lattice_seed(corner_seed,i,j)).get_ids();
+}
+
+void SeamLattice::seam(WFCSolver& solver, bool horizontal, int64_t i, int64_t j, size_t length, std::vector<tile_id>& out, std::vector<tile_id>& scratch) const
+{
+	if(length == 0 || length > cell_size + 1) { throw std::out_of_range("SeamLattice::seam: length not in [1,cell_size+1]"); }
+	if(solver.get_options().wrap) { throw std::invalid_argument("SeamLattice::seam: solver must not wrap around"); }
+	// In the 3x3 tiles of a corner, its row is 3 4 5 and its column 1 4 7
+	std::vector<tile_id> around;
+	corner(solver,i,j,around);
+	scratch.assign(length,WFCSolver::free_cell);
+	scratch[0] = around[4];
+	if(length > 1) { scratch[1] = around[horizontal ? 5 : 7]; }
+	if(length == cell_size + 1)
+	{
+		if(horizontal) { corner(solver,i + 1,j,around); }
+		else { corner(solver,i,j + 1,around); }
+		scratch[length - 2] = around[horizontal ? 3 : 1];
+		scratch[length - 1] = around[4];
+	}
+	// A horizontal seam is one row, a vertical seam one column
+	size_t dim_x = horizontal ? length : 1;
+	size_t dim_y = horizontal ? 1 : length;
+	out = solver.generate_map(dim_x,dim_y,lattice_seed(horizontal ? horizontal_seed : vertical_seed,i,j),scratch).get_ids();
+}
+
+void SeamLattice::region(WFCSolver& solver, int64_t i, int64_t j, size_t width, size_t height, std::vector<tile_id>& out, std::vector<tile_id>& scratch) const
+{
+	if(width > cell_size + 1 || height > cell_size + 1) { throw std::out_of_range("SeamLattice::region: region larger than a lattice cell"); }
+	std::vector<tile_id> top, bottom, left, right;
+	seam(solver,true,i,j,width,top,scratch);
+	seam(solver,false,i,j,height,left,scratch);
+	bool has_right = width == cell_size + 1;
+	bool has_bottom = height == cell_size + 1;
+	if(has_right) { seam(solver,false,i + 1,j,height,right,scratch); }
+	if(has_bottom) { seam(solver,true,i,j + 1,width,bottom,scratch); }
+	scratch.assign(width*height,WFCSolver::free_cell);
+	for(size_t x = 0; x < width; x++)
+	{
+		scratch[x] = top[x];
+		if(has_bottom) { scratch[(height - 1)*width + x] = bottom[x]; }
+	}
+	for(size_t y = 0; y < height; y++)
+	{
+		scratch[y*width] = left[y];
+		if(has_right) { scratch[y*width + width - 1] = right[y]; }
+	}
+	out = solver.generate_map(width,height,lattice_seed(region_seed,i,j),scratch).get_ids();
+}
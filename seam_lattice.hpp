@@ -0,0 +1,63 @@
+#ifndef STRATEGY_SEAM_LATTICE_H
+#define STRATEGY_SEAM_LATTICE_H
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "wfc.hpp"
+
+/*
+SeamLattice
+	Description
+		Splits the plane into square lattice cells of cell_size x cell_size tiles whose borders are generated
+		independently of each other, so that the lattice cells can be generated in any order or in parallel
+		and still fit together:
+			corner (i,j): the tile (i*cell_size, j*cell_size), generated as the center of a 3x3 map
+			horizontal seam (i,j): row j*cell_size starting at corner (i,j), generated as a 1D map
+			vertical seam (i,j): column i*cell_size starting at corner (i,j), generated as a 1D map
+		The four seams that meet at a corner are diagonal neighbours next to it, which a 1D map cannot see. So the
+		3x3 map of a corner also fixes the first tile of each of the four seams (its left, right, upper and lower
+		neighbour), and a seam that reaches the next corner has that corner and its neighbour fixed as its last two
+		tiles. Every corner, seam and region has its own seed derived from the lattice seed and its coordinate.
+		region() generates lattice cell (i,j) with its seams fixed. The object itself is immutable; all
+		generation happens in the WFCSolver that is passed in, so one lattice can be used from many threads
+		with one solver per thread. The solvers must not wrap around (WFCOptions::wrap).
+
+	Example use case:
+		SeamLattice lattice(model,64,42);
+		std::vector<tile_id> tiles, scratch;
+		lattice.region(solver,0,0,65,65,tiles,scratch); // Lattice cell (0,0) including the seams to (1,0) and (0,1)
+*/
+class SeamLattice
+{
+public:
+	SeamLattice(std::shared_ptr<const WFCModel> model, size_t cell_size, uint64_t seed);
+	/*
+	* Generates the 3x3 tiles around corner (i,j) into out (row by row, the corner is out[4])
+	*/
+	void corner(WFCSolver& solver, int64_t i, int64_t j, std::vector<tile_id>& out) const;
+	/*
+	* Generates the length tiles of the horizontal (or vertical) seam (i,j) into out. The last tile is
+	* the next corner if length == cell_size + 1.
+	*/
+	void seam(WFCSolver& solver, bool horizontal, int64_t i, int64_t j, size_t length, std::vector<tile_id>& out, std::vector<tile_id>& scratch) const;
+	/*
+	* Generates the width x height tiles starting at corner (i,j) into out (row by row). The top row and left column
+	* are the seams of (i,j). width == cell_size + 1 adds the vertical seam (i+1,j) as the right column, and
+	* height == cell_size + 1 the horizontal seam (i,j+1) as the bottom row; smaller sizes end at a map edge instead.
+	*/
+	void region(WFCSolver& solver, int64_t i, int64_t j, size_t width, size_t height, std::vector<tile_id>& out, std::vector<tile_id>& scratch) const;
+
+	size_t get_cell_size() const { return cell_size; }
+private:
+	enum SeedKind { corner_seed = 0, horizontal_seed = 1, vertical_seed = 2, region_seed = 3 };
+	/*
+	* Seed of the corner, seam or region of kind at lattice coordinate (i,j)
+	*/
+	uint64_t lattice_seed(SeedKind kind, int64_t i, int64_t j) const;
+
+	std::shared_ptr<const WFCModel> model;
+	size_t cell_size;
+	uint64_t seed;
+};
+
+#endif
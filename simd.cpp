@@ -0,0 +1,473 @@
+#include "simd.hpp"
+#include <cstring>
+#include <stdint.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define WFC_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Coefficients of log2(m) = 2/ln(2)*atanh(t) = sum c_k*t^k, t = (m - 1)/(m + 1), m in [1,2)
+static const double log2_c1 = 2.8853900817779268;  // 2/ln(2)
+static const double log2_c3 = 0.96179669392597560; // 2/(3*ln(2))
+static const double log2_c5 = 0.57707801635558536;
+static const double log2_c7 = 0.41219858311113240;
+static const double log2_c9 = 0.32059889797532520;
+static const double log2_c11 = 0.26230818925253880;
+static const double exponent_bias = 1023.0;
+
+// ---------------------------------------------------------------------------------------------
+// Scalar kernels. Written as 4 lanes so that they round exactly like the vector versions.
+// ---------------------------------------------------------------------------------------------
+
+static inline double fast_log2(double x)
+{
+	uint64_t bits;
+	std::memcpy(&bits,&x,sizeof(bits));
+	double e = (double)(int64_t)(bits >> 52) - exponent_bias;
+	uint64_t mantissa_bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+	double m;
+	std::memcpy(&m,&mantissa_bits,sizeof(m));
+	double t = (m - 1.0)/(m + 1.0);
+	double t2 = t*t;
+	double poly = log2_c11;
+	poly = poly*t2 + log2_c9;
+	poly = poly*t2 + log2_c7;
+	poly = poly*t2 + log2_c5;
+	poly = poly*t2 + log2_c3;
+	poly = poly*t2 + log2_c1;
+	return e + t*poly;
+}
+
+static inline double reduce_lanes(const double* acc)
+{
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+static double scalar_multiply(const double* a, double* b, size_t n)
+{
+	double acc[4] = {0,0,0,0};
+	for(size_t i = 0; i < n; i++)
+	{
+		b[i] *= a[i];
+		acc[i%4] += b[i];
+	}
+	return reduce_lanes(acc);
+}
+
+static void scalar_scale(double* b, size_t n, double factor)
+{
+	for(size_t i = 0; i < n; i++) { b[i] *= factor; }
+}
+
+static double scalar_entropy(const double* p, size_t n)
+{
+	double acc[4] = {0,0,0,0};
+	for(size_t i = 0; i < n; i++)
+	{
+		if(p[i] > 0) { acc[i%4] += p[i]*fast_log2(p[i]); } // 0*log2(0) is taken as 0
+	}
+	return -reduce_lanes(acc);
+}
+
+template <size_t N> // N > 0: compiled for n == N (see SimdKernels::multiply_log_fixed)
+static void scalar_multiply_log(const double* q, const double* log_q, double* w, double* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	double acc[4] = {0,0,0,0};
+	double acc_wlogw[4] = {0,0,0,0};
+	for(size_t i = 0; i < n; i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[i%4] += w[i];
+		acc_wlogw[i%4] += w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+template <size_t N>
+static void scalar_multiply_log_float(const float* q, const float* log_q, float* w, float* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	double acc[4] = {0,0,0,0};
+	double acc_wlogw[4] = {0,0,0,0};
+	for(size_t i = 0; i < n; i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[i%4] += w[i];
+		acc_wlogw[i%4] += (double)w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+// Initializer of SimdKernels::multiply_log_fixed (max_fixed_types + 1 entries) from a kernel template
+#define WFC_FIXED_KERNELS(kernel) { kernel<0>, kernel<1>, kernel<2>, kernel<3>, kernel<4>, kernel<5>, kernel<6>, kernel<7>, kernel<8>, \
+	kernel<9>, kernel<10>, kernel<11>, kernel<12>, kernel<13>, kernel<14>, kernel<15>, kernel<16> }
+
+static const SimdKernels scalar_set = { "scalar", scalar_multiply, scalar_scale, scalar_entropy, scalar_multiply_log<0>, scalar_multiply_log_float<0>,
+	WFC_FIXED_KERNELS(scalar_multiply_log), WFC_FIXED_KERNELS(scalar_multiply_log_float) };
+
+const SimdKernels& scalar_kernels()
+{
+	return scalar_set;
+}
+
+#ifdef WFC_SIMD_X86
+
+// Copies the last n%4 elements of src into a zero padded block of 4
+static inline size_t load_tail(const double* src, size_t n, double* block)
+{
+	size_t tail = n%4;
+	block[0] = 0; block[1] = 0; block[2] = 0; block[3] = 0;
+	std::memcpy(block, src + n - tail, tail*sizeof(double));
+	return tail;
+}
+
+// ---------------------------------------------------------------------------------------------
+// SSE2 kernels (2 doubles per register, two registers hold the 4 lanes)
+// ---------------------------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static inline __m128d sse2_log2(__m128d x)
+{
+	const __m128i bits = _mm_castpd_si128(x);
+	// Exponent: shift the 11 exponent bits down and convert them exactly using the 2^52 trick
+	const __m128i magic = _mm_set1_epi64x(0x4330000000000000LL);
+	__m128d e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits,52),magic)), _mm_set1_pd(4503599627370496.0));
+	e = _mm_sub_pd(e,_mm_set1_pd(exponent_bias));
+	const __m128i mantissa_bits = _mm_or_si128(_mm_and_si128(bits,_mm_set1_epi64x(0x000FFFFFFFFFFFFFLL)),_mm_set1_epi64x(0x3FF0000000000000LL));
+	const __m128d m = _mm_castsi128_pd(mantissa_bits);
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d t = _mm_div_pd(_mm_sub_pd(m,one),_mm_add_pd(m,one));
+	const __m128d t2 = _mm_mul_pd(t,t);
+	__m128d poly = _mm_set1_pd(log2_c11);
+	poly = _mm_add_pd(_mm_mul_pd(poly,t2),_mm_set1_pd(log2_c9));
+	poly = _mm_add_pd(_mm_mul_pd(poly,t2),_mm_set1_pd(log2_c7));
+	poly = _mm_add_pd(_mm_mul_pd(poly,t2),_mm_set1_pd(log2_c5));
+	poly = _mm_add_pd(_mm_mul_pd(poly,t2),_mm_set1_pd(log2_c3));
+	poly = _mm_add_pd(_mm_mul_pd(poly,t2),_mm_set1_pd(log2_c1));
+	return _mm_add_pd(e,_mm_mul_pd(t,poly));
+}
+
+__attribute__((target("sse2")))
+static inline __m128d sse2_plogp(__m128d p)
+{
+	const __m128d positive = _mm_cmpgt_pd(p,_mm_setzero_pd());
+	return _mm_and_pd(positive,_mm_mul_pd(p,sse2_log2(p)));
+}
+
+__attribute__((target("sse2")))
+static double sse2_multiply(const double* a, double* b, size_t n)
+{
+	__m128d acc01 = _mm_setzero_pd();
+	__m128d acc23 = _mm_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m128d prod01 = _mm_mul_pd(_mm_loadu_pd(b + i),_mm_loadu_pd(a + i));
+		const __m128d prod23 = _mm_mul_pd(_mm_loadu_pd(b + i + 2),_mm_loadu_pd(a + i + 2));
+		_mm_storeu_pd(b + i,prod01);
+		_mm_storeu_pd(b + i + 2,prod23);
+		acc01 = _mm_add_pd(acc01,prod01);
+		acc23 = _mm_add_pd(acc23,prod23);
+	}
+	double acc[4];
+	_mm_storeu_pd(acc,acc01);
+	_mm_storeu_pd(acc + 2,acc23);
+	for(size_t lane = 0; i < n; i++, lane++)
+	{
+		b[i] *= a[i];
+		acc[lane] += b[i];
+	}
+	return reduce_lanes(acc);
+}
+
+__attribute__((target("sse2")))
+static void sse2_scale(double* b, size_t n, double factor)
+{
+	const __m128d f = _mm_set1_pd(factor);
+	size_t i = 0;
+	for(; i + 2 <= n; i += 2) { _mm_storeu_pd(b + i,_mm_mul_pd(_mm_loadu_pd(b + i),f)); }
+	for(; i < n; i++) { b[i] *= factor; }
+}
+
+__attribute__((target("sse2")))
+static double sse2_entropy(const double* p, size_t n)
+{
+	__m128d acc01 = _mm_setzero_pd();
+	__m128d acc23 = _mm_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		acc01 = _mm_add_pd(acc01,sse2_plogp(_mm_loadu_pd(p + i)));
+		acc23 = _mm_add_pd(acc23,sse2_plogp(_mm_loadu_pd(p + i + 2)));
+	}
+	double block[4];
+	if(load_tail(p,n,block) > 0)
+	{
+		acc01 = _mm_add_pd(acc01,sse2_plogp(_mm_loadu_pd(block)));
+		acc23 = _mm_add_pd(acc23,sse2_plogp(_mm_loadu_pd(block + 2)));
+	}
+	double acc[4];
+	_mm_storeu_pd(acc,acc01);
+	_mm_storeu_pd(acc + 2,acc23);
+	return -reduce_lanes(acc);
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+static void sse2_multiply_log(const double* q, const double* log_q, double* w, double* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	__m128d acc01 = _mm_setzero_pd(), acc23 = _mm_setzero_pd();
+	__m128d acc_wlogw01 = _mm_setzero_pd(), acc_wlogw23 = _mm_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m128d w01 = _mm_mul_pd(_mm_loadu_pd(w + i),_mm_loadu_pd(q + i));
+		const __m128d w23 = _mm_mul_pd(_mm_loadu_pd(w + i + 2),_mm_loadu_pd(q + i + 2));
+		const __m128d log_w01 = _mm_add_pd(_mm_loadu_pd(log_w + i),_mm_loadu_pd(log_q + i));
+		const __m128d log_w23 = _mm_add_pd(_mm_loadu_pd(log_w + i + 2),_mm_loadu_pd(log_q + i + 2));
+		_mm_storeu_pd(w + i,w01);
+		_mm_storeu_pd(w + i + 2,w23);
+		_mm_storeu_pd(log_w + i,log_w01);
+		_mm_storeu_pd(log_w + i + 2,log_w23);
+		acc01 = _mm_add_pd(acc01,w01);
+		acc23 = _mm_add_pd(acc23,w23);
+		acc_wlogw01 = _mm_add_pd(acc_wlogw01,_mm_mul_pd(w01,log_w01));
+		acc_wlogw23 = _mm_add_pd(acc_wlogw23,_mm_mul_pd(w23,log_w23));
+	}
+	double acc[4], acc_wlogw[4];
+	_mm_storeu_pd(acc,acc01);
+	_mm_storeu_pd(acc + 2,acc23);
+	_mm_storeu_pd(acc_wlogw,acc_wlogw01);
+	_mm_storeu_pd(acc_wlogw + 2,acc_wlogw23);
+	for(size_t lane = 0; lane < n%4; lane++, i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[lane] += w[i];
+		acc_wlogw[lane] += w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+static void sse2_multiply_log_float(const float* q, const float* log_q, float* w, float* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	__m128d acc01 = _mm_setzero_pd(), acc23 = _mm_setzero_pd();
+	__m128d acc_wlogw01 = _mm_setzero_pd(), acc_wlogw23 = _mm_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m128 w4 = _mm_mul_ps(_mm_loadu_ps(w + i),_mm_loadu_ps(q + i));
+		const __m128 log_w4 = _mm_add_ps(_mm_loadu_ps(log_w + i),_mm_loadu_ps(log_q + i));
+		_mm_storeu_ps(w + i,w4);
+		_mm_storeu_ps(log_w + i,log_w4);
+		// Lanes 0-1 and 2-3 converted to double
+		const __m128d w01 = _mm_cvtps_pd(w4), w23 = _mm_cvtps_pd(_mm_movehl_ps(w4,w4));
+		const __m128d log_w01 = _mm_cvtps_pd(log_w4), log_w23 = _mm_cvtps_pd(_mm_movehl_ps(log_w4,log_w4));
+		acc01 = _mm_add_pd(acc01,w01);
+		acc23 = _mm_add_pd(acc23,w23);
+		acc_wlogw01 = _mm_add_pd(acc_wlogw01,_mm_mul_pd(w01,log_w01));
+		acc_wlogw23 = _mm_add_pd(acc_wlogw23,_mm_mul_pd(w23,log_w23));
+	}
+	double acc[4], acc_wlogw[4];
+	_mm_storeu_pd(acc,acc01);
+	_mm_storeu_pd(acc + 2,acc23);
+	_mm_storeu_pd(acc_wlogw,acc_wlogw01);
+	_mm_storeu_pd(acc_wlogw + 2,acc_wlogw23);
+	for(size_t lane = 0; lane < n%4; lane++, i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[lane] += w[i];
+		acc_wlogw[lane] += (double)w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+static const SimdKernels sse2_set = { "sse2", sse2_multiply, sse2_scale, sse2_entropy, sse2_multiply_log<0>, sse2_multiply_log_float<0>,
+	WFC_FIXED_KERNELS(sse2_multiply_log), WFC_FIXED_KERNELS(sse2_multiply_log_float) };
+
+// ---------------------------------------------------------------------------------------------
+// AVX2 kernels (4 doubles per register, one register holds the 4 lanes, the float kernel converts 4 floats at a time)
+// FMA is deliberately not enabled so that results match the other kernels bit for bit.
+// ---------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_log2(__m256d x)
+{
+	const __m256i bits = _mm256_castpd_si256(x);
+	const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+	__m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits,52),magic)), _mm256_set1_pd(4503599627370496.0));
+	e = _mm256_sub_pd(e,_mm256_set1_pd(exponent_bias));
+	const __m256i mantissa_bits = _mm256_or_si256(_mm256_and_si256(bits,_mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),_mm256_set1_epi64x(0x3FF0000000000000LL));
+	const __m256d m = _mm256_castsi256_pd(mantissa_bits);
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d t = _mm256_div_pd(_mm256_sub_pd(m,one),_mm256_add_pd(m,one));
+	const __m256d t2 = _mm256_mul_pd(t,t);
+	__m256d poly = _mm256_set1_pd(log2_c11);
+	poly = _mm256_add_pd(_mm256_mul_pd(poly,t2),_mm256_set1_pd(log2_c9));
+	poly = _mm256_add_pd(_mm256_mul_pd(poly,t2),_mm256_set1_pd(log2_c7));
+	poly = _mm256_add_pd(_mm256_mul_pd(poly,t2),_mm256_set1_pd(log2_c5));
+	poly = _mm256_add_pd(_mm256_mul_pd(poly,t2),_mm256_set1_pd(log2_c3));
+	poly = _mm256_add_pd(_mm256_mul_pd(poly,t2),_mm256_set1_pd(log2_c1));
+	return _mm256_add_pd(e,_mm256_mul_pd(t,poly));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_plogp(__m256d p)
+{
+	const __m256d positive = _mm256_cmp_pd(p,_mm256_setzero_pd(),_CMP_GT_OQ);
+	return _mm256_and_pd(positive,_mm256_mul_pd(p,avx2_log2(p)));
+}
+
+__attribute__((target("avx2")))
+static double avx2_multiply(const double* a, double* b, size_t n)
+{
+	__m256d acc4 = _mm256_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m256d prod = _mm256_mul_pd(_mm256_loadu_pd(b + i),_mm256_loadu_pd(a + i));
+		_mm256_storeu_pd(b + i,prod);
+		acc4 = _mm256_add_pd(acc4,prod);
+	}
+	double acc[4];
+	_mm256_storeu_pd(acc,acc4);
+	for(size_t lane = 0; i < n; i++, lane++)
+	{
+		b[i] *= a[i];
+		acc[lane] += b[i];
+	}
+	return reduce_lanes(acc);
+}
+
+__attribute__((target("avx2")))
+static void avx2_scale(double* b, size_t n, double factor)
+{
+	const __m256d f = _mm256_set1_pd(factor);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) { _mm256_storeu_pd(b + i,_mm256_mul_pd(_mm256_loadu_pd(b + i),f)); }
+	for(; i < n; i++) { b[i] *= factor; }
+}
+
+__attribute__((target("avx2")))
+static double avx2_entropy(const double* p, size_t n)
+{
+	__m256d acc4 = _mm256_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		acc4 = _mm256_add_pd(acc4,avx2_plogp(_mm256_loadu_pd(p + i)));
+	}
+	double block[4];
+	if(load_tail(p,n,block) > 0)
+	{
+		acc4 = _mm256_add_pd(acc4,avx2_plogp(_mm256_loadu_pd(block)));
+	}
+	double acc[4];
+	_mm256_storeu_pd(acc,acc4);
+	return -reduce_lanes(acc);
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+static void avx2_multiply_log(const double* q, const double* log_q, double* w, double* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	__m256d acc4 = _mm256_setzero_pd();
+	__m256d acc_wlogw4 = _mm256_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m256d w4 = _mm256_mul_pd(_mm256_loadu_pd(w + i),_mm256_loadu_pd(q + i));
+		const __m256d log_w4 = _mm256_add_pd(_mm256_loadu_pd(log_w + i),_mm256_loadu_pd(log_q + i));
+		_mm256_storeu_pd(w + i,w4);
+		_mm256_storeu_pd(log_w + i,log_w4);
+		acc4 = _mm256_add_pd(acc4,w4);
+		acc_wlogw4 = _mm256_add_pd(acc_wlogw4,_mm256_mul_pd(w4,log_w4));
+	}
+	double acc[4], acc_wlogw[4];
+	_mm256_storeu_pd(acc,acc4);
+	_mm256_storeu_pd(acc_wlogw,acc_wlogw4);
+	for(size_t lane = 0; lane < n%4; lane++, i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[lane] += w[i];
+		acc_wlogw[lane] += w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+static void avx2_multiply_log_float(const float* q, const float* log_q, float* w, float* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	if(N > 0) { n = N; }
+	__m256d acc4 = _mm256_setzero_pd();
+	__m256d acc_wlogw4 = _mm256_setzero_pd();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+	{
+		const __m128 w4 = _mm_mul_ps(_mm_loadu_ps(w + i),_mm_loadu_ps(q + i));
+		const __m128 log_w4 = _mm_add_ps(_mm_loadu_ps(log_w + i),_mm_loadu_ps(log_q + i));
+		_mm_storeu_ps(w + i,w4);
+		_mm_storeu_ps(log_w + i,log_w4);
+		const __m256d w4d = _mm256_cvtps_pd(w4);
+		acc4 = _mm256_add_pd(acc4,w4d);
+		acc_wlogw4 = _mm256_add_pd(acc_wlogw4,_mm256_mul_pd(w4d,_mm256_cvtps_pd(log_w4)));
+	}
+	double acc[4], acc_wlogw[4];
+	_mm256_storeu_pd(acc,acc4);
+	_mm256_storeu_pd(acc_wlogw,acc_wlogw4);
+	for(size_t lane = 0; lane < n%4; lane++, i++)
+	{
+		w[i] *= q[i];
+		log_w[i] += log_q[i];
+		acc[lane] += w[i];
+		acc_wlogw[lane] += (double)w[i]*log_w[i];
+	}
+	*sum = reduce_lanes(acc);
+	*sum_wlogw = reduce_lanes(acc_wlogw);
+}
+
+static const SimdKernels avx2_set = { "avx2", avx2_multiply, avx2_scale, avx2_entropy, avx2_multiply_log<0>, avx2_multiply_log_float<0>,
+	WFC_FIXED_KERNELS(avx2_multiply_log), WFC_FIXED_KERNELS(avx2_multiply_log_float) };
+
+const SimdKernels* sse2_kernels()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") ? &sse2_set : nullptr;
+}
+
+const SimdKernels* avx2_kernels()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? &avx2_set : nullptr;
+}
+
+#else
+
+const SimdKernels* sse2_kernels() { return nullptr; }
+const SimdKernels* avx2_kernels() { return nullptr; }
+
+#endif
+
+const SimdKernels& simd_kernels()
+{
+	// Initialized once (thread-safe since C++11)
+	static const SimdKernels* best = avx2_kernels() ? avx2_kernels() : (sse2_kernels() ? sse2_kernels() : &scalar_set);
+	return *best;
+}
@@ -0,0 +1,83 @@
+#ifndef STRATEGY_SIMD_H
+#define STRATEGY_SIMD_H
+#include <cstddef>
+
+/*
+SimdKernels
+	Description
+		Vectorized kernels for the probability rows of the wave function (see WFC::dot_and_normalize
+		and WFC::shannon_entropy). There is one set of kernels per instruction set; simd_kernels()
+		detects the CPU features once at runtime and returns the best set available.
+		All sets accumulate sums in 4 interleaved lanes that are reduced in the same order and
+		never use fused multiply-add, so every set returns bit-identical results. The float kernels
+		multiply in float and accumulate the sums in double the same way.
+		multiply_log is also compiled for every n up to max_fixed_types, so the loops over the
+		rows of small tilesets have constant trip counts and unroll (see multiply_log_for).
+
+	Example use case:
+		const SimdKernels& k = simd_kernels();
+		double sum = k.multiply(neig_probs,wave,n_types);
+		k.scale(wave,n_types,1.0/sum);
+		double H = k.entropy(wave,n_types);
+		k.multiply_log(neig_probs,log_neig_probs,wave,log_wave,n_types,&sum,&sum_wlogw);
+		k.multiply_log_for(n_types)(neig_probs,log_neig_probs,wave,log_wave,n_types,&sum,&sum_wlogw);
+*/
+struct SimdKernels
+{
+	typedef void (*MultiplyLog)(const double* q, const double* log_q, double* w, double* log_w, size_t n, double* sum, double* sum_wlogw);
+	typedef void (*MultiplyLogFloat)(const float* q, const float* log_q, float* w, float* log_w, size_t n, double* sum, double* sum_wlogw);
+	static const size_t max_fixed_types = 16;
+
+	const char* name;
+	/*
+	* b[i] *= a[i] for i < n. Returns the sum of the products.
+	*/
+	double (*multiply)(const double* a, double* b, size_t n);
+	/*
+	* b[i] *= factor for i < n
+	*/
+	void (*scale)(double* b, size_t n, double factor);
+	/*
+	* Shannon entropy -sum(p_i*log_2(p_i)) of n probabilities, with 0*log2(0) taken as 0.
+	* log2 is approximated with a polynomial (absolute error below 1e-7).
+	*/
+	double (*entropy)(const double* p, size_t n);
+	/*
+	* w[i] *= q[i] and log_w[i] += log_q[i] for i < n (log_q and log_w hold log2 of q and w).
+	* Stores the new sum(w) in *sum and sum(w*log_w) in *sum_wlogw, i.e. updates the running
+	* sums of a cell of WaveFunction without calling log2.
+	*/
+	MultiplyLog multiply_log;
+	/*
+	* multiply_log on float rows. The products are rounded to float, the sums are accumulated in double.
+	*/
+	MultiplyLogFloat multiply_log_float;
+	/*
+	* multiply_log and multiply_log_float compiled for a constant n: entry n (0 < n <= max_fixed_types) ignores its
+	* n argument. Entry 0 is the generic kernel.
+	*/
+	MultiplyLog multiply_log_fixed[max_fixed_types + 1];
+	MultiplyLogFloat multiply_log_float_fixed[max_fixed_types + 1];
+
+	/*
+	* The fastest multiply_log (or multiply_log_float) for rows of n types. Gives the same results for every n.
+	*/
+	MultiplyLog multiply_log_for(size_t n) const { return n <= max_fixed_types ? multiply_log_fixed[n] : multiply_log; }
+	MultiplyLogFloat multiply_log_float_for(size_t n) const { return n <= max_fixed_types ? multiply_log_float_fixed[n] : multiply_log_float; }
+};
+
+/*
+* Returns the fastest kernels supported by the running CPU (AVX2, SSE2 or scalar). Detection runs once.
+*/
+const SimdKernels& simd_kernels();
+/*
+* Returns the portable kernels (always available)
+*/
+const SimdKernels& scalar_kernels();
+/*
+* Return the kernels of a specific instruction set, or nullptr if the build or the running CPU does not support it
+*/
+const SimdKernels* sse2_kernels();
+const SimdKernels* avx2_kernels();
+
+#endif
@@ -0,0 +1,103 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t n_threads) : job(nullptr), remaining(0), batch(0), stop(false)
+{
+	if(n_threads == 0) { n_threads = 1; }
+	for(size_t i = 0; i < n_threads; i++) { queues.emplace_back(new TaskQueue()); }
+	for(size_t i = 0; i < n_threads; i++) { workers.emplace_back(&ThreadPool::work, this, i); }
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	start_cv.notify_all();
+	for(std::thread& worker : workers) { worker.join(); }
+}
+
+size_t ThreadPool::hardware_threads()
+{
+	size_t n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void ThreadPool::run(size_t n_tasks, const std::function<void(size_t,size_t)>& task)
+{
+	if(n_tasks == 0) { return; }
+	size_t n_workers = workers.size();
+	std::unique_lock<std::mutex> lock(mutex);
+	job = &task;
+	error = nullptr;
+	remaining = n_tasks;
+	// Contiguous blocks keep neighbouring tasks on the same thread until stealing starts
+	for(size_t w = 0; w < n_workers; w++)
+	{
+		std::lock_guard<std::mutex> queue_lock(queues[w]->mutex);
+		for(size_t i = w*n_tasks/n_workers; i < (w + 1)*n_tasks/n_workers; i++) { queues[w]->tasks.push_back(i); }
+	}
+	batch++;
+	start_cv.notify_all();
+	done_cv.wait(lock,[this]{ return remaining == 0; });
+	job = nullptr;
+	if(error) { std::rethrow_exception(error); }
+}
+
+void ThreadPool::work(size_t worker)
+{
+	size_t seen = 0;
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start_cv.wait(lock,[&]{ return stop || batch != seen; });
+			if(stop) { return; }
+			seen = batch;
+		}
+		size_t task;
+		while(next_task(worker,task))
+		{
+			try
+			{
+				(*job)(task,worker);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(!error) { error = std::current_exception(); }
+			}
+			if(remaining.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done_cv.notify_all();
+			}
+		}
+	}
+}
+
+bool ThreadPool::next_task(size_t worker, size_t& task)
+{
+	{
+		TaskQueue& own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if(!own.tasks.empty())
+		{
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+	for(size_t i = 1; i < queues.size(); i++)
+	{
+		TaskQueue& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.tasks.empty())
+		{
+			task = victim.tasks.back();
+			victim.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
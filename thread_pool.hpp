@@ -0,0 +1,70 @@
+#ifndef STRATEGY_THREAD_POOL_H
+#define STRATEGY_THREAD_POOL_H
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+
+/*
+ThreadPool
+	Description
+		Fixed set of worker threads for running batches of independent tasks (e.g. WFC::generate_batch).
+		run() splits the task indices into one contiguous block per worker. A worker takes tasks from the
+		front of its own deque and, once that is empty, steals from the back of the other workers' deques,
+		so threads that got cheap tasks help out the ones with expensive tasks.
+		The threads sleep between batches and are joined by the destructor.
+
+	Example use case:
+		ThreadPool pool(4);
+		std::vector<double> results(1000);
+		pool.run(results.size(),[&](size_t task, size_t worker) { results[task] = work(task,per_worker_state[worker]); });
+*/
+class ThreadPool
+{
+public:
+	/*
+	* Starts n_threads worker threads (at least one)
+	*/
+	explicit ThreadPool(size_t n_threads);
+	~ThreadPool();
+	/*
+	* Calls task(i,worker) for every i < n_tasks and returns when all calls are done. worker (< size()) identifies
+	* the calling thread, so that tasks can use per-thread state without locking.
+	* If tasks throw, the first exception is rethrown here after the batch is done.
+	*/
+	void run(size_t n_tasks, const std::function<void(size_t,size_t)>& task);
+	size_t size() const { return workers.size(); }
+	/*
+	* Number of hardware threads (at least 1)
+	*/
+	static size_t hardware_threads();
+private:
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+	void work(size_t worker);
+	/*
+	* Takes a task from the own queue of worker, or steals one from another queue. Returns false if all queues are empty.
+	*/
+	bool next_task(size_t worker, size_t& task);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<TaskQueue>> queues; // One per worker
+	std::mutex mutex; // Guards batch, stop and error
+	std::condition_variable start_cv; // Signals a new batch (or stop) to the workers
+	std::condition_variable done_cv; // Signals the end of a batch to run()
+	const std::function<void(size_t,size_t)>* job;
+	std::atomic<size_t> remaining; // Tasks of the current batch that have not finished yet
+	size_t batch; // Incremented for every batch
+	bool stop;
+	std::exception_ptr error;
+};
+
+#endif
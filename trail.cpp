@@ -0,0 +1,61 @@
+#include "trail.hpp"
+#include <algorithm>
+
+template <typename Real>
+void Trail::reset(const Domains& domains, const BasicWaveFunction<Real>* wave, size_t max_bytes_)
+{
+	clear();
+	n_words = domains.words();
+	n_doubles = 2 + (wave != nullptr ? 2*wave->stride() + 2 : 0);
+	max_bytes = max_bytes_;
+	saved_level.assign(domains.size(),0);
+	level = 1;
+}
+
+template <typename Real>
+void Trail::save(size_t cell, const Domains& domains, const BasicWaveFunction<Real>* wave)
+{
+	if(saved_level[cell] == level) { return; }
+	saved_level[cell] = level;
+	cells.push_back(cell);
+	words.insert(words.end(), domains[cell], domains[cell] + n_words);
+	values.push_back(domains.sum(cell));
+	values.push_back(domains.sum_wlogw(cell));
+	if(wave != nullptr)
+	{
+		values.insert(values.end(), (*wave)[cell], (*wave)[cell] + wave->stride());
+		values.insert(values.end(), wave->log_weights(cell), wave->log_weights(cell) + wave->stride());
+		values.push_back(wave->sum(cell));
+		values.push_back(wave->sum_wlogw(cell));
+	}
+}
+
+template <typename Real>
+void Trail::undo(size_t mark, Domains& domains, BasicWaveFunction<Real>* wave, std::vector<unsigned int>& cells_out)
+{
+	cells_out.clear();
+	while(cells.size() > mark)
+	{
+		unsigned int cell = cells.back();
+		const uint64_t* domain = &words[words.size() - n_words];
+		const double* v = &values[values.size() - n_doubles];
+		domains.restore(cell, domain, v[0], v[1]);
+		if(wave != nullptr)
+		{
+			size_t stride = wave->stride();
+			wave->restore(cell, v + 2, v + 2 + stride, v[2 + 2*stride], v[3 + 2*stride]);
+		}
+		cells_out.push_back(cell);
+		cells.pop_back();
+		words.resize(words.size() - n_words);
+		values.resize(values.size() - n_doubles);
+	}
+	level++; // The restored cells have to be saved again on their next change
+}
+
+template void Trail::reset(const Domains&, const WaveFunction*, size_t);
+template void Trail::reset(const Domains&, const WaveFunctionFloat*, size_t);
+template void Trail::save(size_t, const Domains&, const WaveFunction*);
+template void Trail::save(size_t, const Domains&, const WaveFunctionFloat*);
+template void Trail::undo(size_t, Domains&, WaveFunction*, std::vector<unsigned int>&);
+template void Trail::undo(size_t, Domains&, WaveFunctionFloat*, std::vector<unsigned int>&);
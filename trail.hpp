@@ -0,0 +1,67 @@
+#ifndef STRATEGY_TRAIL_H
+#define STRATEGY_TRAIL_H
+#include <vector>
+#include <stdint.h>
+#include "domains.hpp"
+#include "wave_function.hpp"
+
+/*
+Trail
+	Description
+		Undo log used by WFC to backtrack after a contradiction (ContradictionPolicy::backtrack).
+		Before a cell is changed for the first time within a decision level, save() appends a snapshot of
+		that cell only (its domain, and its weights if a wave function is given) instead of copying the
+		whole wave function. Weights of both precisions are stored as doubles, which is exact. undo(mark) restores the snapshots taken after mark in reverse order, so
+		every cell ends up in the state it had when mark was taken.
+		The snapshots are stored in flat buffers that keep their capacity, and full() reports when
+		they exceed the byte budget given to reset().
+
+	Example use case:
+		trail.begin_level();
+		size_t mark = trail.size();
+		trail.save(cell,domains,&wave_function);
+		domains.ban(cell,type_idx);
+		trail.undo(mark,domains,&wave_function);
+*/
+class Trail
+{
+public:
+	Trail() : n_words(0), n_doubles(0), max_bytes(0), level(0) {}
+	/*
+	* Empties the trail and sizes it for snapshots of domains (and wave, which may be nullptr).
+	* max_bytes bounds the memory of the snapshots (see full()).
+	*/
+	template <typename Real> void reset(const Domains& domains, const BasicWaveFunction<Real>* wave, size_t max_bytes);
+	/*
+	* Starts a new decision level: every cell is saved again on its next change
+	*/
+	void begin_level() { level++; }
+	/*
+	* Appends a snapshot of cell unless it was saved in the current decision level already
+	*/
+	template <typename Real> void save(size_t cell, const Domains& domains, const BasicWaveFunction<Real>* wave);
+	/*
+	* Restores every snapshot taken after mark (a previous size()), newest first, and removes them. Starts a new level.
+	* Returns the restored cells through cells_out (may contain a cell more than once).
+	*/
+	template <typename Real> void undo(size_t mark, Domains& domains, BasicWaveFunction<Real>* wave, std::vector<unsigned int>& cells_out);
+	/*
+	* Drops all snapshots without restoring them (the current state becomes final)
+	*/
+	void clear() { cells.clear(); words.clear(); values.clear(); }
+
+	size_t size() const { return cells.size(); } // Number of snapshots
+	size_t bytes() const { return cells.size()*(sizeof(unsigned int) + n_words*sizeof(uint64_t) + n_doubles*sizeof(double)); }
+	bool full() const { return bytes() > max_bytes; }
+private:
+	std::vector<unsigned int> cells; // Cell of each snapshot
+	std::vector<uint64_t> words; // n_words domain words per snapshot
+	std::vector<double> values; // n_doubles per snapshot: domain sums, then weights, log weights and weight sums
+	std::vector<uint32_t> saved_level; // Level in which each cell was last saved
+	size_t n_words;
+	size_t n_doubles;
+	size_t max_bytes;
+	uint32_t level;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "wave_function.hpp"
+#include <algorithm>
+
+template <typename Real> const size_t BasicWaveFunction<Real>::alignment;
+template <typename Real> const double BasicWaveFunction<Real>::log_zero = -1e30;
+
+template <typename Real>
+void BasicWaveFunction<Real>::reset(size_t n_cells_, const std::vector<double>& init)
+{
+	const size_t values_per_line = alignment/sizeof(Real);
+	n_cells = n_cells_;
+	n_types = init.size();
+	row_stride = (n_types + values_per_line - 1)/values_per_line*values_per_line;
+	// Logarithms and sums of init are computed once and copied to every cell
+	log_init.resize(n_types);
+	double sum = 0, sum_wlogw = 0;
+	for(size_t i = 0; i < n_types; i++)
+	{
+		// The sums are taken over the rounded weights, like those of multiply_log
+		const Real w = (Real)init[i];
+		log_init[i] = w > 0 ? (Real)log2((double)w) : (Real)log_zero;
+		sum += w;
+		sum_wlogw += (double)w*log_init[i];
+	}
+	data.assign(n_cells*row_stride, 0);
+	log_data.assign(n_cells*row_stride, 0);
+	for(size_t cell = 0; cell < n_cells; cell++)
+	{
+		std::copy(init.begin(), init.end(), data.begin() + cell*row_stride);
+		std::copy(log_init.begin(), log_init.end(), log_data.begin() + cell*row_stride);
+	}
+	collapsed.assign((n_cells + 63)/64, 0);
+	sums.assign(n_cells, sum);
+	wlogw_sums.assign(n_cells, sum_wlogw);
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::clear()
+{
+	// Swap with empty containers in order to release all memory
+	std::vector<Real, AlignedAllocator<Real,alignment>>().swap(data);
+	std::vector<Real, AlignedAllocator<Real,alignment>>().swap(log_data);
+	std::vector<uint64_t>().swap(collapsed);
+	std::vector<double>().swap(sums);
+	std::vector<double>().swap(wlogw_sums);
+	std::vector<Real>().swap(log_init);
+	n_cells = 0; n_types = 0; row_stride = 0;
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::collapse(size_t cell, size_t type_idx)
+{
+	Real* w = (*this)[cell];
+	Real* log_w = log_weights(cell);
+	std::fill(w, w + n_types, (Real)0);
+	std::fill(log_w, log_w + n_types, (Real)log_zero);
+	w[type_idx] = 1;
+	log_w[type_idx] = 0;
+	sums[cell] = 1;
+	wlogw_sums[cell] = 0;
+	collapsed[cell/64] |= (uint64_t)1 << (cell%64);
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::set_uniform(size_t cell)
+{
+	Real* w = (*this)[cell];
+	Real* log_w = log_weights(cell);
+	std::fill(w, w + n_types, (Real)(1.0/n_types));
+	std::fill(log_w, log_w + n_types, (Real)-log2((double)n_types));
+	sums[cell] = 1;
+	wlogw_sums[cell] = -log2((double)n_types);
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::ban(size_t cell, size_t type_idx)
+{
+	Real* w = (*this)[cell];
+	Real* log_w = log_weights(cell);
+	sums[cell] -= w[type_idx];
+	wlogw_sums[cell] -= (double)w[type_idx]*log_w[type_idx];
+	w[type_idx] = 0;
+	log_w[type_idx] = (Real)log_zero;
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::update_sums(size_t cell)
+{
+	const Real* w = (*this)[cell];
+	const Real* log_w = log_weights(cell);
+	double sum = 0, sum_wlogw = 0;
+	for(size_t t = 0; t < n_types; t++)
+	{
+		sum += w[t];
+		sum_wlogw += (double)w[t]*log_w[t];
+	}
+	sums[cell] = sum;
+	wlogw_sums[cell] = sum_wlogw;
+}
+
+template <typename Real>
+void BasicWaveFunction<Real>::restore(size_t cell, const double* w, const double* log_w, double sum, double sum_wlogw)
+{
+	std::copy(w, w + row_stride, (*this)[cell]);
+	std::copy(log_w, log_w + row_stride, log_weights(cell));
+	sums[cell] = sum;
+	wlogw_sums[cell] = sum_wlogw;
+	collapsed[cell/64] &= ~((uint64_t)1 << (cell%64));
+}
+
+template class BasicWaveFunction<double>;
+template class BasicWaveFunction<float>;
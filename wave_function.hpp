@@ -0,0 +1,102 @@
+#ifndef STRATEGY_WAVE_FUNCTION_H
+#define STRATEGY_WAVE_FUNCTION_H
+#include <vector>
+#include <stdint.h>
+#include <math.h>
+#include "aligned_allocator.hpp"
+
+/*
+BasicWaveFunction<Real>
+	Description
+		Structure-of-arrays storage for the wave function of WFC::generate_map.
+		All weights live in one contiguous buffer of n_cells rows. Each row holds the
+		(unnormalized) weight of every tile type for one cell as a Real (double or float) and is padded
+		with zeros to a multiple of 32 bytes, so every row starts on a SIMD-aligned address. A second
+		buffer of the same shape holds log2 of every weight.
+		Next to the weights the class keeps a bitset of collapsed cells and two running sums per cell,
+		sum(w) and sum(w*log2(w)), which are updated whenever weights change. The shannon entropy of the
+		normalized weights then is O(1) to query: H = log2(sum(w)) - sum(w*log2(w))/sum(w)
+		The running sums are double for both weight types. Float weights halve the rows (see
+		WeightPrecision), but are rounded to float after every multiplication.
+		reset() only reallocates when the number of cells or types grows, so repeated
+		generations of the same size do not allocate.
+		WaveFunction is BasicWaveFunction<double>, WaveFunctionFloat BasicWaveFunction<float>.
+*/
+template <typename Real>
+class BasicWaveFunction
+{
+public:
+	static const size_t alignment = 32; // In bytes (AVX register width)
+	static const double log_zero; // Stand-in for log2(0): finite, so that 0*log_zero == 0
+
+	BasicWaveFunction() : n_cells(0), n_types(0), row_stride(0) {}
+	/*
+	* Resizes the wave function to n_cells rows and copies init (one weight per type, rounded to Real) to every row.
+	* The logarithms and running sums of init are computed once and shared by all cells. All cells are marked as not collapsed.
+	*/
+	void reset(size_t n_cells, const std::vector<double>& init);
+	/*
+	* Releases all memory
+	*/
+	void clear();
+
+	Real* operator[](size_t cell) { return &data[cell*row_stride]; }
+	const Real* operator[](size_t cell) const { return &data[cell*row_stride]; }
+	Real* log_weights(size_t cell) { return &log_data[cell*row_stride]; }
+	const Real* log_weights(size_t cell) const { return &log_data[cell*row_stride]; }
+
+	bool is_collapsed(size_t cell) const { return (collapsed[cell/64] >> (cell%64)) & 1; }
+	/*
+	* Sets all weight of cell to type_idx and marks the cell collapsed
+	*/
+	void collapse(size_t cell, size_t type_idx);
+	/*
+	* Gives every type of cell the same weight (used when a contradiction occured)
+	*/
+	void set_uniform(size_t cell);
+	/*
+	* Sets the weight of type_idx in cell to 0 and subtracts it from the running sums
+	*/
+	void ban(size_t cell, size_t type_idx);
+
+	/*
+	* Recomputes the running sums of cell from its weights
+	*/
+	void update_sums(size_t cell);
+	/*
+	* Overwrites the weights (stride() values each) and the running sums of cell, e.g. with a snapshot taken
+	* before the cell was collapsed or multiplied. The cell is marked as not collapsed.
+	*/
+	void restore(size_t cell, const double* w, const double* log_w, double sum, double sum_wlogw);
+
+	double sum(size_t cell) const { return sums[cell]; }
+	double sum_wlogw(size_t cell) const { return wlogw_sums[cell]; }
+	void set_sums(size_t cell, double sum, double sum_wlogw) { sums[cell] = sum; wlogw_sums[cell] = sum_wlogw; }
+	/*
+	* Shannon entropy of the normalized weights of cell, from the running sums
+	*/
+	double entropy(size_t cell) const { return sums[cell] > 0 ? log2(sums[cell]) - wlogw_sums[cell]/sums[cell] : 0; }
+
+	size_t size() const { return n_cells; }
+	size_t get_n_types() const { return n_types; }
+	size_t stride() const { return row_stride; } // Number of values between the starts of two consecutive rows
+private:
+	std::vector<Real, AlignedAllocator<Real,alignment>> data; // n_cells*row_stride weights
+	std::vector<Real, AlignedAllocator<Real,alignment>> log_data; // log2 of data
+	std::vector<uint64_t> collapsed; // One bit per cell
+	std::vector<double> sums; // sum(w) per cell
+	std::vector<double> wlogw_sums; // sum(w*log2(w)) per cell
+	std::vector<Real> log_init; // Scratch for reset: log2 of the initial weights
+	size_t n_cells;
+	size_t n_types;
+	size_t row_stride;
+};
+
+// Compiled in wave_function.cpp
+extern template class BasicWaveFunction<double>;
+extern template class BasicWaveFunction<float>;
+
+typedef BasicWaveFunction<double> WaveFunction;
+typedef BasicWaveFunction<float> WaveFunctionFloat;
+
+#endif
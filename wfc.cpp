@@ -1,4 +1,9 @@
 #include "wfc.hpp"
+#include "seam_lattice.hpp"
+#include "mapped_file.hpp"
+#include "binary_map.hpp"
+#include "patterns.hpp"
+#include <cstring>
 
 
 StringMap::StringMap(std::string filename) : width(0), height(0) 
@@ -9,46 +14,122 @@ StringMap::StringMap(std::string filename) : width(0), height(0)
 	}
 	catch(incorrect_map_lines& e)
 	{
-		std::cout << "Importing StringMap failed!\n" << e.what() << ". Emptying StringMap...." << std::endl;
+		WFC_LOG(LogLevel::error,"Importing StringMap failed! " << e.what() << ". Emptying StringMap....");
 		erase_data();
 	}
 	catch(std::exception& e)
 	{
-		std::cout << "Importing StringMap failed!\n" << e.what() << std::endl;
+		WFC_LOG(LogLevel::error,"Importing StringMap failed! " << e.what());
 	}
 	
-	types = calculate_types();
+}
+
+StringMap::StringMap(size_t dim_x, size_t dim_y, const std::vector<std::string>& palette) : width(dim_x), height(dim_y)
+{
+	for(const std::string& str : palette) { intern(str); }
+	data.reserve(dim_x*dim_y);
+}
+
+void StringMap::reset(size_t dim_x, size_t dim_y, const std::vector<std::string>& palette)
+{
+	width = dim_x;
+	height = dim_y;
+	data.clear();
+	data.reserve(dim_x*dim_y);
+	if(types == palette) { return; } // The interning table is still valid
+	types.clear();
+	std::fill(type_slots.begin(),type_slots.end(),0);
+	for(const std::string& str : palette) { intern(str); }
+}
+
+// FNV-1a hash of a tile name
+static uint32_t hash_name(const char* str, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for(size_t i = 0; i < len; i++) { h = (h ^ (unsigned char)str[i])*16777619u; }
+	return h;
+}
+
+tile_id StringMap::intern(const char* str, size_t len)
+{
+	if(type_slots.empty()) { type_slots.assign(16,0); }
+	size_t mask = type_slots.size() - 1;
+	size_t slot = hash_name(str,len) & mask;
+	for(; type_slots[slot] != 0; slot = (slot + 1) & mask)
+	{
+		const std::string& type = types[type_slots[slot] - 1];
+		if(type.size() == len && std::equal(str,str + len,type.begin())) { return type_slots[slot] - 1; }
+	}
+	// The largest id is reserved: it is WFCSolver::free_cell in the given tiles of generate_map
+	if(types.size() >= std::numeric_limits<tile_id>::max()) { throw std::length_error("StringMap: too many different tile types"); }
+	tile_id id = types.size();
+	types.push_back(std::string(str,len));
+	type_slots[slot] = (uint32_t)id + 1;
+	if(2*types.size() > type_slots.size())
+	{
+		// Keep the table at most half full
+		std::vector<uint32_t> old_slots(2*type_slots.size(),0);
+		old_slots.swap(type_slots);
+		mask = type_slots.size() - 1;
+		for(uint32_t old_slot : old_slots)
+		{
+			if(old_slot == 0) { continue; }
+			const std::string& type = types[old_slot - 1];
+			size_t s = hash_name(type.data(),type.size()) & mask;
+			while(type_slots[s] != 0) { s = (s + 1) & mask; }
+			type_slots[s] = old_slot;
+		}
+	}
+	return id;
 }
 
 bool StringMap::import(std::string filename)
 {
-	std::ifstream istr_row;
-	std::string line;
-	std::string word;
-	istr_row.open(filename,std::ifstream::in);
-	size_t width_temp; // Counting value for number of columns on each line
+	MappedFile file(filename);
 	erase_data();
-	while(std::getline(istr_row,line))
+	if(BinaryMapReader::is_binary_map(file.data(),file.size()))
 	{
-		width_temp = 0;
-		std::stringstream istr_col(line);
-		
-		while(std::getline(istr_col,word,';'))
+		*this = BinaryMapReader(filename).to_string_map();
+		return true;
+	}
+	// Single pass over the mapped bytes: rows end at '\n' (an optional '\r' before it is dropped) and cells
+	// at ';'. A ';' at the end of a row does not start another cell.
+	const char* p = file.data();
+	const char* end = p + file.size();
+	const char* prev = nullptr; // Last cell, neighbouring cells are often the same type
+	size_t prev_len = 0;
+	tile_id prev_id = 0;
+	while(p < end)
+	{
+		const char* line_end = static_cast<const char*>(std::memchr(p,'\n',end - p));
+		const char* next = line_end ? line_end + 1 : end;
+		if(!line_end) { line_end = end; }
+		if(line_end > p && line_end[-1] == '\r') { line_end--; }
+		size_t width_temp = 0; // Counting value for number of columns on this line
+		while(p < line_end)
 		{
-			data.push_back(word);
+			const char* cell_end = static_cast<const char*>(std::memchr(p,';',line_end - p));
+			if(!cell_end) { cell_end = line_end; }
+			size_t len = cell_end - p;
+			if(prev == nullptr || len != prev_len || !std::equal(p,cell_end,prev)) { prev_id = intern(p,len); }
+			prev = p; prev_len = len;
+			data.push_back(prev_id);
 			width_temp++;
+			p = cell_end + 1;
 		}
-		if(width == 0){width = width_temp;} //If this is first row
-		else
+		if(height == 0)
 		{
-			if(width != width_temp)
-			{
-				//IF lengths of lines in file are inconsistent
-				throw incorrect_map_lines();
-				return false;
-			}
+			//If this is first row, guess the number of rows from its length
+			width = width_temp;
+			data.reserve(width*(file.size()/(next - file.data()) + 1));
+		}
+		else if(width != width_temp)
+		{
+			//IF lengths of lines in file are inconsistent
+			throw incorrect_map_lines();
 		}
 		height += 1;
+		p = next;
 	}
 	return true;
 }
@@ -57,6 +138,8 @@ void StringMap::erase_data()
 {
 	//std::cout << "Erasing tileMap data...." << std::endl;
 	data.clear();
+	types.clear();
+	type_slots.clear();
 	width = 0; height = 0;
 }
 
@@ -67,9 +150,9 @@ void StringMap::print() const
 	{
 		std::cout << "Map of size" << width << "x" << height << std::endl;
 		unsigned int str_idx = 1;
-		for(std::string str_i : data)
+		for(tile_id id : data)
 		{
-			std::cout << str_i;
+			std::cout << types[id];
 			if(str_idx % width == 0) { std::cout << "\n"; } else { std::cout << "-";}
 			str_idx++;
 		}
@@ -77,28 +160,13 @@ void StringMap::print() const
 	}
 }
 
-std::vector<std::string> StringMap::calculate_types()
-{
-	std::vector<std::string> types;
-	for(std::string str : data)
-	{
-		// If: not found
-		if(std::find(types.begin(), types.end(), str) == types.end()) {types.push_back(str);}
-	}
-	return types;
-}
-
-
 std::vector<double> StringMap::calculate_frequency()
 {
-	std::vector<double> freqs;
-	int sum = width*height;
-	for(std::string str : types)
-	{
-		int occ_i = std::count(data.begin(),data.end(),str);
-		double freq_i = (double)occ_i/(double)sum;
-		freqs.push_back(freq_i);
-	}
+	// Histogram of tile ids in one pass over data
+	std::vector<double> freqs(types.size(),0.0);
+	for(tile_id id : data) { freqs[id] += 1; }
+	double sum = width*height;
+	for(double& freq_i : freqs) { freq_i = freq_i/sum; }
 	return freqs;
 }
 
@@ -126,56 +194,97 @@ std::map<std::string,int> StringMap::get_type_map() const
 void StringMap::write_to_file(std::string filename) const
 {
 	std::ofstream ofs (filename, std::ofstream::out);
-	std::cout << "Writing generated map to " << filename << std::endl;
-	unsigned int str_idx = 1;
-	for(std::string str_i : data)
+	WFC_LOG(LogLevel::debug,"Writing generated map to " << filename);
+	// Rows are assembled in one string and written with a single call each
+	std::string row;
+	for(size_t y = 0; y < height; y++)
 	{
-		ofs << str_i;
-		if(str_idx % width == 0) { ofs << "\n"; } else { ofs << ";";}
-		str_idx++;
+		row.clear();
+		for(size_t x = 0; x < width; x++)
+		{
+			row += types[data[y*width + x]];
+			row += x + 1 == width ? '\n' : ';';
+		}
+		ofs.write(row.data(),row.size());
 	}
 }
 
-// Constructor
-WFC::WFC(std::string filename) : m_filename(filename) , input_sample(filename) 
+void StringMap::write_binary(std::string filename) const
+{
+	BinaryMapWriter writer(filename,width,height,types);
+	for(size_t y = 0; y < height; y++) { writer.write_row(data.data() + y*width); }
+	writer.close();
+}
+
+// Constructors
+WFCModel::WFCModel(std::string filename, ModelOptions options) : m_filename(filename) , input_sample(filename) , neig_stride(0) , neig_stride_float(0) , adjacency_words(0) , model_options(options)
 {
-	tile_type_map = input_sample.get_type_map();
 	tile_types = input_sample.get_types();
 	freq_vector = input_sample.calculate_frequency();
-	size_t n_types = tile_type_map.size();;
-	for(auto it = tile_type_map.begin(); it != tile_type_map.end(); it++)
+	if(options.learning == LearningMode::overlapping)
 	{
-		std::vector<double> zeros;
-		std::vector<std::vector<double>> zeros2D;
-		zeros.insert(zeros.begin(),n_types,0.0);
-		zeros2D.insert(zeros2D.begin(),8,zeros);
-		neig_probs.insert(std::make_pair(it->first,zeros2D));
+		// An empty sample is reported by generate_map (freq_vector_empty) like in adjacent mode
+		if(!freq_vector.empty()) { calculate_patterns(); }
 	}
-	calculate_neigs();
+	else
+	{
+		size_t n_types = tile_types.size();
+		// Rows of neig_probs are padded like the rows of the wave function
+		const size_t doubles_per_line = WaveFunction::alignment/sizeof(double);
+		neig_stride = (n_types + doubles_per_line - 1)/doubles_per_line*doubles_per_line;
+		neig_probs.assign(n_types*8*neig_stride,0.0);
+		calculate_neigs();
+		calculate_neigs_float();
+		calculate_adjacency();
+	}
+	calculate_compatible();
+	model_hash = calculate_hash();
 }
 
-void WFC::print_input() const
+const tile_id WFCSolver::free_cell;
+
+WFCSolver::WFCSolver(std::shared_ptr<const WFCModel> model, WFCOptions options) : model(model) , options(options) , kernels(&simd_kernels()) , seed(0) , last_dim_x(0) , last_dim_y(0) , rng(0) , attempt(0) , attempt_started(false) , map_done(false) , n_random(0) , first_n(0) , scan_pos(0) , scan_side(0) , scan_set(0) , logging(false) , repair_contradictions(true) , backtracking(false) , attempt_backtracks(0) 
+{
+	if(model->get_model_options().learning == LearningMode::overlapping && options.mode != SolverMode::bitset)
+	{
+		throw std::invalid_argument("WFCSolver: overlapping models need SolverMode::bitset");
+	}
+	if(model->get_model_options().learning == LearningMode::overlapping && options.order != CollapseOrder::entropy)
+	{
+		throw std::invalid_argument("WFCSolver: overlapping models need CollapseOrder::entropy");
+	}
+}
+
+WFC::WFC(std::string filename, WFCOptions options, ModelOptions model_options) : WFCSolver(std::make_shared<WFCModel>(filename,model_options),options) 
+{
+}
+
+WFC::WFC(std::shared_ptr<const WFCModel> model, WFCOptions options) : WFCSolver(model,options) 
+{
+}
+
+void WFCModel::print_input() const
 {
 	input_sample.print();
 }
 
-void WFC::print_types() const
+void WFCModel::print_types() const
 {
 	std::cout << "Types: " << std::endl;
-	if(tile_type_map.begin() == tile_type_map.end()) 
+	if(tile_types.empty()) 
 	{ 
 		std::cout << "(Empty)" << std::endl; 
 	}
 	else
 	{
-		for(auto it = tile_type_map.begin(); it != tile_type_map.end();it++)
+		for(size_t type_idx = 0; type_idx < tile_types.size(); type_idx++)
 		{
-			std::cout << it->first << "," << it->second << std::endl;
+			std::cout << tile_types[type_idx] << "," << type_idx << std::endl;
 		}
 	}
 }
 
-void WFC::print_freqs() const
+void WFCModel::print_freqs() const
 {	
 	std::cout << "Frequencies of all types: ";
 	if(freq_vector.begin() == freq_vector.end())
@@ -192,22 +301,25 @@ void WFC::print_freqs() const
 	std::cout << std::endl;
 }
 
-void WFC::print_neigs() const
+void WFCModel::print_neigs() const
 {
 	std::cout << "Neighbour probabilities for each tile type: " << std::endl;
-	if(neig_probs.begin() == neig_probs.end())
+	if(tile_types.empty())
 	{
 		std::cout << "(Empty)" << std::endl;
 	}
+	else if(model_options.learning == LearningMode::overlapping)
+	{
+		std::cout << "(None, overlapping model of " << get_n_patterns() << " patterns)" << std::endl;
+	}
 	else
 	{
-		for(auto it = neig_probs.begin();it != neig_probs.end(); it++)
+		for(unsigned int type_idx = 0; type_idx < tile_types.size(); type_idx++)
 		{
-			std::cout << it->first << ": " << std::endl;
-			for(auto neig : it->second)
+			std::cout << tile_types[type_idx] << ": " << std::endl;
+			for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
 			{
-				for(auto prob : neig)
-					std::cout << prob << ", ";
+				print_vector(neig_prob(type_idx,neig_i),tile_types.size());
 				std::cout << std::endl;
 			}
 		}
@@ -215,156 +327,547 @@ void WFC::print_neigs() const
 	}
 }
 
-void WFC::print_wave_function(size_t dim_x,size_t dim_y) const
+// Weights of every cell, dim_x cells per line
+template <typename Real>
+static void print_weights(const BasicWaveFunction<Real>& weights, size_t dim_x)
+{
+	if(weights.size() == 0) { std::cout << "(Empty)"; return; }
+	for(unsigned int wave_idx = 1; wave_idx <= weights.size(); wave_idx++)
+	{
+		WFCModel::print_vector(weights[wave_idx - 1],weights.get_n_types());
+		if(wave_idx % dim_x == 0) { std::cout << "\n"; } else { std::cout << "|";}
+	}
+}
+
+void WFCSolver::print_wave_function(size_t dim_x) const
 {
 	std::cout << "Wave function: " << std::endl;
-	if(wave_function.size() == 0) { std::cout << "(Empty)"; }
-	else
+	if(options.mode == SolverMode::bitset)
 	{
-		unsigned int wave_idx = 1;
-		for(std::vector<double> wave_i : wave_function)
+		// Allowed types of each cell, e.g. G/W
+		for(unsigned int wave_idx = 1; wave_idx <= domains.size(); wave_idx++)
 		{
-			print_vector(wave_i);
+			std::string sep = "";
+			for(size_t type_idx = 0; type_idx < model->get_n_patterns(); type_idx++)
+			{
+				if(domains.contains(wave_idx - 1,type_idx)) { std::cout << sep << model->get_types()[model->tile_of(type_idx)]; sep = "/"; }
+			}
 			if(wave_idx % dim_x == 0) { std::cout << "\n"; } else { std::cout << "|";}
-		}		
+		}
 	}
+	else if(options.precision == WeightPrecision::float32) { print_weights(wave_function_float,dim_x); }
+	else { print_weights(wave_function,dim_x); }
 	std::cout << std::endl;
 
 }
 
-void WFC::calculate_neigs()
+void WFCModel::calculate_neigs()
 {	
+	Grid grid;
+	grid.reset(input_sample.get_width(),input_sample.get_height());
 	for(unsigned idx = 0; idx < input_sample.get_width()*input_sample.get_height();idx++)
 	{
-		neigs_rotation_increment(idx);
+		neigs_rotation_increment(idx,grid);
 	}
 	neigs_normalize();
+	// Logarithms are taken once here, so that updating the entropy of a cell needs no log2 calls
+	log_neig_probs.assign(neig_probs.size(),0.0);
+	for(size_t i = 0; i < neig_probs.size(); i++)
+	{
+		log_neig_probs[i] = neig_probs[i] > 0 ? log2(neig_probs[i]) : WaveFunction::log_zero;
+	}
+}
+
+void WFCModel::calculate_neigs_float()
+{
+	size_t n_types = tile_types.size();
+	// Rows are padded like the rows of WaveFunctionFloat
+	const size_t floats_per_line = WaveFunctionFloat::alignment/sizeof(float);
+	neig_stride_float = (n_types + floats_per_line - 1)/floats_per_line*floats_per_line;
+	neig_probs_float.assign(n_types*8*neig_stride_float,0.0f);
+	log_neig_probs_float.assign(neig_probs_float.size(),0.0f);
+	for(size_t row = 0; row < n_types*8; row++)
+	{
+		for(size_t t = 0; t < n_types; t++)
+		{
+			// The logarithm of the rounded probability, so that weights and log weights stay consistent
+			float p = (float)neig_probs[row*neig_stride + t];
+			neig_probs_float[row*neig_stride_float + t] = p;
+			log_neig_probs_float[row*neig_stride_float + t] = p > 0 ? (float)log2((double)p) : (float)WaveFunction::log_zero;
+		}
+	}
 }
 // Rotates clock-wise starting from 9 o' Clock. Utilized for the input sample alone when initializing neighbour probs.
-// TODO: Avoid access out of range
-void WFC::neigs_rotation_increment(unsigned int idx)
+void WFCModel::neigs_rotation_increment(unsigned int idx, const Grid& grid)
 {
-	std::string cur_type = input_sample[idx];
-	size_t dim_x = input_sample.get_width();
-	size_t dim_y = input_sample.get_height();
-	std::string cur_neig_type; // The neighbour we currently are looking at (the one rotated)
-	unsigned int count = 0;
-	for(unsigned int neig_idx : get_neighbours(idx, dim_x, dim_y))
+	tile_id cur_type = input_sample.get_id(idx);
+	uint8_t valid = grid.mask(idx);
+	const int* offsets = grid.offsets(idx);
+	for(unsigned int count = 0; count < 8; count++)
 	{
 		// Check whether neighbour is valid. Else: skip
-		if(neig_idx < dim_x*dim_y - 1)
+		if(valid >> count & 1)
 		{
-			cur_neig_type = input_sample[neig_idx];
-			neig_probs[cur_type][count][tile_type_map[cur_neig_type]] += 1;			
+			// The neighbour we currently are looking at (the one rotated)
+			neig_prob(cur_type,count)[input_sample.get_id(idx + offsets[count])] += 1;
 		}
-		count++;
 	}
 }
-// TODO: fix it so it actually updates neig_probs
-void WFC::neigs_normalize()
+void WFCModel::neigs_normalize()
 {
-	for(auto it = neig_probs.begin();it != neig_probs.end(); it++)
+	size_t n_types = tile_types.size();
+	for(unsigned int type_idx = 0; type_idx < n_types; type_idx++)
 	{
-		for(std::vector<double> neig : it->second)
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
 		{
+			double* neig = neig_prob(type_idx,neig_i);
 			double sum = 0;
-			for(double prob : neig) { sum += prob; }
-			for(unsigned int i = 0; i < neig.size();i++) { neig[i] = neig[i]/sum; } // Normalization step
+			for(size_t i = 0; i < n_types; i++) { sum += neig[i]; }
+			if(sum <= 0) { continue; } // Type never seen with a neighbour in this direction
+			for(size_t i = 0; i < n_types; i++) { neig[i] = neig[i]/sum; } // Normalization step
 		}
 	}
 }
 
-StringMap WFC::generate_map(size_t dim_x, size_t dim_y)
+void WFCModel::calculate_adjacency()
 {
-	//0. Erase old data in containers
-	// TODO: swap with empty vector in order to completely release all memory (?)
-	wave_function.clear();
-	if(freq_vector.size() == 0) { throw freq_vector_empty(); }
-	
+	size_t n_types = tile_types.size();
+	adjacency_words = (n_types + 63)/64;
+	adjacency.assign(n_types*8*adjacency_words,0);
+	for(unsigned int type_idx = 0; type_idx < n_types; type_idx++)
+	{
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
+		{
+			const double* probs = neig_prob(type_idx,neig_i);
+			for(unsigned int neig_type = 0; neig_type < n_types; neig_type++)
+			{
+				if(probs[neig_type] <= 0) { continue; }
+				// neig_type may be in direction neig_i of type_idx, so type_idx may be in the opposite direction of neig_type
+				adjacency[(type_idx*8 + neig_i)*adjacency_words + neig_type/64] |= (uint64_t)1 << (neig_type%64);
+				adjacency[(neig_type*8 + (neig_i + 4)%8)*adjacency_words + type_idx/64] |= (uint64_t)1 << (type_idx%64);
+			}
+		}
+	}
+}
+
+void WFCModel::calculate_patterns()
+{
+	Patterns patterns(input_sample,model_options.pattern_size,model_options.symmetry,model_options.periodic_input);
+	size_t n_patterns = patterns.size();
+	double total = 0;
+	for(unsigned int p = 0; p < n_patterns; p++) { total += patterns.count(p); }
+	pattern_weights.resize(n_patterns);
+	pattern_tiles.resize(n_patterns);
+	for(unsigned int p = 0; p < n_patterns; p++)
+	{
+		pattern_weights[p] = patterns.count(p)/total;
+		pattern_tiles[p] = patterns.tile(p,0,0);
+	}
+	// Compatibility is symmetric by construction (q east of p <=> p west of q)
+	adjacency_words = (n_patterns + 63)/64;
+	adjacency.assign(n_patterns*8*adjacency_words,0);
+	for(unsigned int p = 0; p < n_patterns; p++)
+	{
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
+		{
+			for(unsigned int q : patterns.compatible(p,neig_i))
+			{
+				adjacency[(p*8 + neig_i)*adjacency_words + q/64] |= (uint64_t)1 << (q%64);
+			}
+		}
+	}
+}
+
+void WFCModel::calculate_compatible()
+{
+	size_t n_patterns = get_n_patterns();
+	compatible.clear();
+	compatible_offsets.assign(1,0);
+	for(unsigned int p = 0; p < n_patterns; p++)
+	{
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++)
+		{
+			const uint64_t* mask = adjacency_mask(p,neig_i);
+			for(size_t w = 0; w < adjacency_words; w++)
+			{
+				for(uint64_t bits = mask[w]; bits; bits &= bits - 1) { compatible.push_back(w*64 + __builtin_ctzll(bits)); }
+			}
+			compatible_offsets.push_back(compatible.size());
+		}
+	}
+	tile_masks.assign(tile_types.size()*adjacency_words,0);
+	for(unsigned int p = 0; p < n_patterns; p++)
+	{
+		tile_masks[tile_of(p)*adjacency_words + p/64] |= (uint64_t)1 << (p%64);
+	}
+}
+
+// FNV-1a step over the n_bytes lowest bytes of value, least significant byte first
+static void fnv1a(uint64_t& hash, uint64_t value, int n_bytes)
+{
+	for(int i = 0; i < n_bytes; i++) { hash = (hash ^ ((value >> (8*i)) & 0xFF))*0x100000001b3ULL; }
+}
+
+uint64_t WFCModel::calculate_hash() const
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	fnv1a(hash,tile_types.size(),8);
+	for(const std::string& type : tile_types)
+	{
+		for(char c : type) { fnv1a(hash,(unsigned char)c,1); }
+		fnv1a(hash,0,1); // Terminator, so that e.g. "ab","c" and "a","bc" differ
+	}
+	fnv1a(hash,input_sample.get_width(),8);
+	fnv1a(hash,input_sample.get_height(),8);
+	for(tile_id id : input_sample.get_ids()) { fnv1a(hash,id,2); }
+	if(model_options.learning == LearningMode::overlapping)
+	{
+		fnv1a(hash,model_options.pattern_size,8);
+		fnv1a(hash,model_options.symmetry,1);
+		fnv1a(hash,model_options.periodic_input,1);
+	}
+	return hash;
+}
+
+StringMap WFCSolver::generate_map(size_t dim_x, size_t dim_y)
+{
+	return generate_map(dim_x,dim_y,(uint64_t)std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+StringMap WFCSolver::generate_map(size_t dim_x, size_t dim_y, uint64_t seed_)
+{
+	return generate_map(dim_x,dim_y,seed_,std::vector<tile_id>());
+}
+
+StringMap WFCSolver::generate_map(size_t dim_x, size_t dim_y, uint64_t seed_, const std::vector<tile_id>& fixed)
+{
+	StringMap sm(0,0);
+	generate_map_into(sm,dim_x,dim_y,seed_,fixed);
+	return sm;
+}
+
+void WFCSolver::generate_map_into(StringMap& out, size_t dim_x, size_t dim_y, uint64_t seed_)
+{
+	generate_map_into(out,dim_x,dim_y,seed_,std::vector<tile_id>());
+}
+
+void WFCSolver::generate_map_into(StringMap& out, size_t dim_x, size_t dim_y, uint64_t seed_, const std::vector<tile_id>& fixed)
+{
+	begin_map(dim_x,dim_y,seed_,fixed);
+	step_map(std::chrono::nanoseconds::max());
+	finish_map(out);
+}
+
+void WFCSolver::begin_map(size_t dim_x, size_t dim_y, uint64_t seed_, const std::vector<tile_id>& fixed)
+{
+	if(model->get_freqs().size() == 0) { throw freq_vector_empty(); }
+	if(!fixed.empty() && fixed.size() != dim_x*dim_y) { throw std::invalid_argument("generate_map: fixed.size() != dim_x*dim_y"); }
+	WFC_LOG(LogLevel::debug,"Generating map of dimensions: " << dim_x << "x" << dim_y << " ......");
+	// Initialize parameters
+	seed = seed_;
+	last_dim_x = dim_x;
+	last_dim_y = dim_y;
+	rng = Xoshiro256(seed);
+	fixed_cells.assign(fixed.begin(),fixed.end());
+	stats = PropagationStats();
+	attempt = 0;
+	attempt_started = false;
+	map_done = false;
+	collapse_log.clear();
+#ifdef WFC_PROFILE
+	profiler.reset(options.trace);
+#endif
+}
+
+bool WFCSolver::step_map(std::chrono::nanoseconds budget, size_t max_collapses)
+{
+	if(map_done) { return true; }
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::generate);
+	StepBudget step;
+	step.timed = budget != std::chrono::nanoseconds::max();
+	if(step.timed) { step.deadline = std::chrono::steady_clock::now() + budget; }
+	step.collapses_left = std::max<size_t>(max_collapses,1);
+	step.until_check = 16;
+	bool entropy = options.order == CollapseOrder::entropy;
+	while(true)
+	{
+		if(!attempt_started)
+		{
+			// The last attempt repairs contradictions in place, so that a map is always returned
+			repair_contradictions = options.contradiction == ContradictionPolicy::repair || attempt >= options.max_restarts;
+			collapse_log.clear();
+			attempt_started = true;
+			if(!(entropy ? start_attempt() : start_scanline()))
+			{
+				stats.restarts++;
+				attempt++;
+				attempt_started = false;
+				WFC_LOG(LogLevel::debug,"Contradiction occured! Restarting generation");
+				continue;
+			}
+		}
+		AttemptState state = entropy ? advance_attempt(step) : advance_scanline(step);
+		if(state == AttemptState::running) { return false; }
+		if(state == AttemptState::solved) { break; }
+		stats.restarts++;
+		attempt++;
+		attempt_started = false;
+		WFC_LOG(LogLevel::debug,"Contradiction occured! Restarting generation");
+	}
+	map_done = true;
+	WFC_LOG(LogLevel::debug,"Generation successful!");
+	return true;
+}
+
+void WFCSolver::finish_map(StringMap& out)
+{
+	if(!map_done) { throw std::logic_error("finish_map: the map is not complete, step_map has not returned true yet"); }
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::output);
+	create_stringMap(out,last_dim_x,last_dim_y);
+}
+
+size_t WFCSolver::collapsed_cells() const
+{
+	if(options.order != CollapseOrder::entropy) { return scan_set; }
+	if(!attempt_started) { return 0; }
+	return last_dim_x*last_dim_y - queue.size();
+}
+
+void WFCSolver::regenerate(StringMap& map, size_t x0, size_t y0, size_t width, size_t height, uint64_t seed_)
+{
+	regenerate(map,x0,y0,width,height,seed_,std::vector<uint8_t>());
+}
+
+void WFCSolver::regenerate(StringMap& map, size_t x0, size_t y0, size_t width, size_t height, uint64_t seed_, const std::vector<uint8_t>& mask)
+{
+	size_t map_x = map.get_width(), map_y = map.get_height();
+	if(width == 0 || height == 0) { return; }
+	if(x0 + width > map_x || y0 + height > map_y) { throw std::out_of_range("regenerate: rectangle outside the map"); }
+	if(!mask.empty() && mask.size() != width*height) { throw std::invalid_argument("regenerate: mask.size() != width*height"); }
+	// Cells whose tile constrains the rectangle: the neighbours, or all cells covered by the patterns of the rectangle
+	const ModelOptions& model_options = model->get_model_options();
+	int64_t border = model_options.learning == LearningMode::overlapping ? (int64_t)model_options.pattern_size - 1 : 1;
+	int64_t bx0 = (int64_t)x0 - border, by0 = (int64_t)y0 - border;
+	int64_t bx1 = (int64_t)(x0 + width) + border, by1 = (int64_t)(y0 + height) + border;
+	if(options.wrap)
+	{
+		if(bx1 - bx0 > (int64_t)map_x || by1 - by0 > (int64_t)map_y) { throw std::out_of_range("regenerate: rectangle and border larger than the wrapping map"); }
+	}
+	else
+	{
+		bx0 = std::max(bx0,(int64_t)0);
+		by0 = std::max(by0,(int64_t)0);
+		bx1 = std::min(bx1,(int64_t)map_x);
+		by1 = std::min(by1,(int64_t)map_y);
+	}
+	size_t dim_x = bx1 - bx0, dim_y = by1 - by0;
+	// Tile ids of map -> tile ids of the model, by name
+	const std::vector<std::string>& model_types = model->get_types();
+	std::unordered_map<std::string,tile_id> model_ids;
+	for(size_t i = 0; i < model_types.size(); i++) { model_ids[model_types[i]] = i; }
+	std::vector<tile_id> to_model(map.get_types().size(),free_cell);
+	for(size_t i = 0; i < map.get_types().size(); i++)
+	{
+		std::unordered_map<std::string,tile_id>::const_iterator it = model_ids.find(map.get_types()[i]);
+		if(it != model_ids.end()) { to_model[i] = it->second; }
+	}
+	std::vector<tile_id> fixed(dim_x*dim_y,free_cell);
+	std::vector<unsigned int> cells(dim_x*dim_y); // Index in map of every cell of the box
+	for(size_t y = 0; y < dim_y; y++)
+	{
+		for(size_t x = 0; x < dim_x; x++)
+		{
+			int64_t mx = bx0 + (int64_t)x, my = by0 + (int64_t)y;
+			bool inside = mx >= (int64_t)x0 && mx < (int64_t)(x0 + width) && my >= (int64_t)y0 && my < (int64_t)(y0 + height);
+			if(options.wrap)
+			{
+				mx = (mx % (int64_t)map_x + map_x) % map_x;
+				my = (my % (int64_t)map_y + map_y) % map_y;
+			}
+			unsigned int idx = my*map_x + mx;
+			cells[y*dim_x + x] = idx;
+			if(inside && (mask.empty() || mask[(my - y0)*width + (mx - x0)])) { continue; }
+			tile_id id = to_model[map.get_id(idx)];
+			if(id == free_cell) { throw std::invalid_argument("regenerate: tile " + map[idx] + " is not a tile type of the model"); }
+			fixed[y*dim_x + x] = id;
+		}
+	}
+	// The box is solved as a map of its own: it must not wrap around itself
+	bool wrap = options.wrap;
+	options.wrap = false;
+	StringMap box(0,0);
+	try
+	{
+		box = generate_map(dim_x,dim_y,seed_,fixed);
+	}
+	catch(...)
+	{
+		options.wrap = wrap;
+		throw;
+	}
+	options.wrap = wrap;
+	// Tile ids of the model -> tile ids of map, adding types the map did not contain yet
+	std::vector<tile_id> to_map(model_types.size(),free_cell);
+	for(size_t i = 0; i < fixed.size(); i++)
+	{
+		if(fixed[i] != free_cell) { continue; }
+		tile_id id = box.get_id(i);
+		if(to_map[id] == free_cell) { to_map[id] = map.add_type(model_types[id]); }
+		map.set_id(cells[i],to_map[id]);
+	}
+}
+
+bool WFCSolver::start_attempt()
+{
+	size_t dim_x = last_dim_x, dim_y = last_dim_y;
+	const std::vector<tile_id>& fixed = fixed_cells;
 	//1. Initialize WaveFunction with dimensions dim_x*dim_y. Set each value to freq_vector. Initialize queue.
-	//TODO: What if freq_vector is empty?
-	std::cout << "Generating map of dimensions: " << dim_x << "x" << dim_y << " ......" << std::endl;
-	double sh_entropy = shannon_entropy(freq_vector);
+	// Old data is overwritten in place, the buffers are only reallocated if the map grows
+	// The initial entropy is computed once from freq_vector and shared by all cells
+	domains.reset(dim_x*dim_y,model->get_weights());
+	if(options.mode == SolverMode::probabilistic)
+	{
+		if(options.precision == WeightPrecision::float32) { wave_function_float.reset(dim_x*dim_y,model->get_weights()); }
+		else { wave_function.reset(dim_x*dim_y,model->get_weights()); }
+	}
+	queue.reset(dim_x*dim_y);
 	for(unsigned int i = 0; i < dim_x*dim_y;i++)
 	{
-		wave_function.push_back(freq_vector);
-		queue.push_back(std::make_pair(10000,i));
+		queue.push(i,cell_entropy(i));
 	}
-	// Initialize parameters
-	unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-	std::default_random_engine generator(seed);
-	std::uniform_real_distribution<double> real_distribution(0.0,1.0); // For generating tile types
-	int queue_idx; double type; int wave_idx; int type_idx;
-	//2. Set First n random Tiles to tiletype (weighted by probs)
-	unsigned int first_n = (dim_x*dim_y)/90; // divisor a magic value that is inversely proportional to the number of initial randomized tiles
-	//std::cout << "first_n = " << first_n << std::endl;
-	for(unsigned int k = 0; k < first_n;k++)
-	{
-		unsigned int max_idx = queue.size()-1;
-		if(max_idx >= queue.size() || max_idx >= wave_function.size()) { throw std::out_of_range("generate_map: max_idx larger than queue/wave_function size"); }
-		std::uniform_int_distribution<int> int_distribution(0,max_idx); // For generating first queue index
-		queue_idx = int_distribution(generator);
-		queue_idx = int_distribution(generator); // Generate one time extra (0 is generated for some reason the first time always)
-		type = real_distribution(generator);
-		//std::cout << "Randomly choosing first queue index..... " << queue_idx << std::endl;
-		//std::cout << "Randomly choosing first type..... " << type << std::endl;  
-		wave_idx = queue[queue_idx].second;
-		type_idx = get_type_idx(freq_vector,type);
-		set_tile_type(wave_idx,type_idx);
-		//update_neighbours(wave_idx,dim_x,dim_y);
-		//3. Update probabilities of all affected neighbours
-		update_wave_neigs(wave_idx,type_idx,dim_x,dim_y);	
-		//4. Remove from queue
-		queue.erase(queue.begin() + queue_idx);
-	}
-	//5. Loop through the queue
-	size_t n_iterations = queue.size();
-	for(unsigned int count = 0; count < n_iterations; count++)
-	{
-		//std::cout << "-----------ITERATION-" << count << "-----------" << std::endl; 
-		// 1. Sort the queue according to shannon entropy (after entropy values have been updated in update_wave_neigs)
-		std::sort(queue.begin(), queue.end());
-		// 2. Choose Tile with lowest entropy
-		if(queue.size() == 0) { throw std::out_of_range("generate_map: queue is empty before it should be. bug in code?"); }
-		wave_idx = queue[0].second;
-		// 3. Choose a tiletype randomly and set it to wave_idx
-		type = real_distribution(generator);
-		if(wave_idx > wave_function.size()){ throw std::out_of_range("generate_map: wave_idx > wave_function.size()"); }
-		type_idx = get_type_idx(wave_function[wave_idx],type);
-		set_tile_type(wave_idx,type_idx);
-		// 4. Update wave function of neighbours
-		update_wave_neigs(wave_idx,type_idx,dim_x,dim_y);
-		// 5. Erase first element in queue
-		queue.erase(queue.begin());
-	}
-	//std::cout << "WAVEFUNCTION READY:" << std::endl;
-	//print_wave_function(dim_x,dim_y);
-	// Wavefunction is ready!
-	// Create StringMap based on Wave function
-	StringMap sm = create_stringMap(dim_x,dim_y);
-	//std::cout << "STRINGMAP READY: " << std::endl;
-	//sm.print();
-	std::cout << "Generation successful! " << std::endl;
-	return sm;
+	// Propagation scratch space is sized once here, propagate itself never allocates
+	grid.reset(dim_x,dim_y,options.wrap);
+	worklist.reset(dim_x*dim_y);
+	allowed.resize(domains.words());
+	backtracking = options.contradiction == ContradictionPolicy::backtrack && !repair_contradictions;
+	if(options.mode == SolverMode::bitset) { trail.reset(domains,(const WaveFunction*)nullptr,options.max_trail_bytes); }
+	else if(options.precision == WeightPrecision::float32) { trail.reset(domains,&wave_function_float,options.max_trail_bytes); }
+	else { trail.reset(domains,&wave_function,options.max_trail_bytes); }
+	decisions.clear();
+	attempt_backtracks = 0;
+	// Given cells are not decisions: they are never undone, so they are not recorded in the trail
+	bool record = backtracking;
+	backtracking = false;
+	for(unsigned int i = 0; i < fixed.size(); i++)
+	{
+		if(fixed[i] == free_cell) { continue; }
+		if(fixed[i] >= model->get_n_types()) { throw std::out_of_range("generate_map: fixed tile id >= number of tile types"); }
+		if(model->get_model_options().learning == LearningMode::adjacent)
+		{
+			queue.erase(i);
+			if(!collapse_cell(i,fixed[i])) { return false; }
+			continue;
+		}
+		// Overlapping model: the cell keeps the patterns of the given tile and is collapsed like the others later
+		const uint64_t* mask = model->tile_mask(fixed[i]);
+		if(!has_support(i,mask))
+		{
+			stats.contradictions++;
+			if(!repair_contradictions) { return false; }
+			continue;
+		}
+		restrict_cell(i,mask);
+		worklist.push(i);
+		if(!propagate()) { return false; }
+	}
+	backtracking = record;
+	//2. Set First n random Tiles to tiletype (weighted by probs), then loop through the queue
+	first_n = (dim_x*dim_y)/90; // divisor a magic value that is inversely proportional to the number of initial randomized tiles
+	n_random = 0;
+	return true;
 }
 
-double WFC::shannon_entropy(std::vector<double> probs) const
+WFCSolver::AttemptState WFCSolver::advance_attempt(StepBudget& budget)
 {
-	// H = -sum(p_i*log_2(p_i))
-	double H = 0;
-	for(double p_i : probs)
+	size_t dim_x = last_dim_x, dim_y = last_dim_y;
+	double type; unsigned int wave_idx; unsigned int type_idx;
+	while(!queue.empty())
+	{
+		{
+			WFC_PROFILE_SCOPE(profiler,ProfilePhase::select);
+			if(n_random < first_n)
+			{
+				n_random++;
+				wave_idx = queue.at(rng.below(queue.size())); // Random queued cell
+				//3. Remove from queue
+				queue.erase(wave_idx);
+			}
+			else
+			{
+				// Choose Tile with lowest entropy (entropy values are kept up to date by propagation) and remove it from queue
+				wave_idx = queue.pop();
+			}
+			// Choose a tiletype randomly
+			type = rng.uniform();
+			if(wave_idx >= dim_x*dim_y){ throw std::out_of_range("solve: wave_idx >= wave_function.size()"); }
+			type_idx = choose_type(wave_idx,type);
+		}
+		if(backtracking)
+		{
+			trail.begin_level();
+			decisions.push_back(Decision(wave_idx,type_idx,trail.size()));
+		}
+		//4. Set tile type and update wave function of neighbours
+		if(collapse_cell(wave_idx,type_idx))
+		{
+			if(backtracking && trail.full())
+			{
+				// Keep the undo log bounded: everything collapsed so far becomes final
+				trail.clear();
+				decisions.clear();
+			}
+		}
+		else if(!backtracking || !backtrack())
+		{
+			return AttemptState::failed;
+		}
+		if(budget.spent()) { return AttemptState::running; }
+	}
+	return AttemptState::solved;
+}
+
+bool WFCSolver::backtrack()
+{
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::contradiction);
+	size_t words = domains.words();
+	while(!decisions.empty() && attempt_backtracks < options.max_backtracks)
 	{
-		H += p_i*log2(p_i);
+		Decision d = decisions.back();
+		decisions.pop_back();
+		stats.backtracks++;
+		attempt_backtracks++;
+		if(options.mode == SolverMode::bitset) { trail.undo(d.trail_mark,domains,(WaveFunction*)nullptr,restored); }
+		else if(options.precision == WeightPrecision::float32) { trail.undo(d.trail_mark,domains,&wave_function_float,restored); }
+		else { trail.undo(d.trail_mark,domains,&wave_function,restored); }
+		for(unsigned int cell : restored)
+		{
+			if(queue.contains(cell)) { WFC_PROFILE_COUNT(profiler,entropy_updates); queue.update(cell,cell_entropy(cell)); }
+		}
+		queue.push(d.cell,cell_entropy(d.cell));
+		// Ban the type that led to the contradiction. The ban belongs to the previous decision and is undone with it.
+		std::copy(domains[d.cell],domains[d.cell] + words,allowed.begin());
+		allowed[d.type_idx/64] &= ~((uint64_t)1 << (d.type_idx%64));
+		if(!has_support(d.cell,allowed.data())) { continue; }
+		restrict_cell(d.cell,allowed.data());
+		worklist.push(d.cell);
+		if(propagate()) { return true; }
 	}
-	return -H;
+	return false;
+}
+
+double WFCSolver::shannon_entropy(const double* probs, size_t n_types) const
+{
+	// H = -sum(p_i*log_2(p_i))
+	return kernels->entropy(probs,n_types);
 }
 // Gets type_idx from randomly generated double value type (0-1)
-int WFC::get_type_idx(std::vector<double> probs,double type) const
+template <typename Real>
+int WFCSolver::get_type_idx(const Real* probs, size_t n_types, double type) const
 {
 	//std::cout << "|||||||||||| get_type_idx ||||||||||||" << std::endl;
-	//std::cout << "INPUTS probs: "; print_vector(probs); std::cout << "type: " << type << std::endl; 
+	//std::cout << "INPUTS probs: "; WFCModel::print_vector(probs,n_types); std::cout << "type: " << type << std::endl; 
 	double current = 0;
-	for(unsigned int type_idx = 0; type_idx < probs.size(); type_idx++)
+	for(unsigned int type_idx = 0; type_idx < n_types; type_idx++)
 	{
 		current += probs[type_idx];
 		//std::cout << "current: " << current << ", type: " << type << std::endl;
@@ -374,18 +877,61 @@ int WFC::get_type_idx(std::vector<double> probs,double type) const
 			return type_idx; 
 		}
 	}
+	// type can round up to the sum of the weights, then the last type with non-zero weight is chosen
+	for(unsigned int type_idx = n_types; type_idx > 0; type_idx--)
+	{
+		if(probs[type_idx - 1] > 0) { return type_idx - 1; }
+	}
 	throw std::out_of_range("get_type_idx: exited loop before type < current. This should never happen. Bug in code?");
 }
 
-void WFC::set_tile_type(unsigned int wave_idx,unsigned int type_idx)
+template int WFCSolver::get_type_idx(const double* probs, size_t n_types, double type) const;
+template int WFCSolver::get_type_idx(const float* probs, size_t n_types, double type) const;
+
+unsigned int WFCSolver::choose_type(unsigned int wave_idx, double type) const
+{
+	if(options.mode == SolverMode::bitset)
+	{
+		size_t type_idx = domains.weighted_type(wave_idx,type*domains.sum(wave_idx));
+		if(type_idx >= model->get_n_patterns()) { throw std::out_of_range("choose_type: empty domain. This should never happen. Bug in code?"); }
+		return type_idx;
+	}
+	if(options.precision == WeightPrecision::float32)
+	{
+		return get_type_idx(wave_function_float[wave_idx],wave_function_float.get_n_types(),type*wave_function_float.sum(wave_idx));
+	}
+	return get_type_idx(wave_function[wave_idx],wave_function.get_n_types(),type*wave_function.sum(wave_idx));
+}
+
+bool WFCSolver::collapse_cell(unsigned int wave_idx, unsigned int type_idx)
+{
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::collapse);
+	if(wave_idx >= domains.size()) { throw std::out_of_range("collapse_cell: wave_idx >= domains.size()"); }
+	save_cell(wave_idx);
+	domains.collapse(wave_idx,type_idx);
+	stats.collapses++;
+	if(logging) { collapse_log.push_back(CellUpdate{wave_idx,model->tile_of(type_idx)}); }
+	if(options.mode == SolverMode::probabilistic)
+	{
+		set_tile_type(wave_idx,type_idx);
+		if(!update_wave_neigs(wave_idx,type_idx)) { return false; }
+	}
+	worklist.push(wave_idx);
+	return propagate();
+}
+
+void WFCSolver::set_tile_type(unsigned int wave_idx,unsigned int type_idx)
 {
 	//std::cout << "|||||||||||| set_tile_type ||||||||||||" << std::endl;
 	//std::cout << "INPUTS idx: " << wave_idx << ", type_idx: " << type_idx << std::endl; 
-	if(wave_idx < wave_function.size())
+	if(options.precision == WeightPrecision::float32 && wave_idx < wave_function_float.size())
 	{
-		std::fill(wave_function[wave_idx].begin(), wave_function[wave_idx].end(), 0);
-		wave_function[wave_idx][type_idx] = 1;
-		//std::cout << "------> return: "; print_vector(wave_function[wave_idx]); std::cout << std::endl;		
+		wave_function_float.collapse(wave_idx,type_idx);
+	}
+	else if(options.precision == WeightPrecision::float64 && wave_idx < wave_function.size())
+	{
+		wave_function.collapse(wave_idx,type_idx);
+		//std::cout << "------> return: "; WFCModel::print_vector(wave_function[wave_idx],wave_function.get_n_types()); std::cout << std::endl;		
 	}
 	else
 	{
@@ -393,136 +939,436 @@ void WFC::set_tile_type(unsigned int wave_idx,unsigned int type_idx)
 	}
 }
 
-std::vector<unsigned int> WFC::get_neighbours(unsigned int idx, size_t dim_x, size_t dim_y)
+void WFCModel::get_neighbours(unsigned int idx, size_t dim_x, size_t dim_y, unsigned int* indices)
 {
-	std::vector<unsigned int> indices;
-	size_t max_idx = dim_x*dim_y - 1;
+	size_t max_idx = dim_x*dim_y;
 	unsigned int n_idx;
 	// W
 	n_idx = idx - 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x)){indices[0] = n_idx;} else {indices[0] = -1;}
 	//NW
 	n_idx = idx - dim_x - 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices[1] = n_idx;} else {indices[1] = -1;}
 	//N
 	n_idx = idx - dim_x;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices[2] = n_idx;} else {indices[2] = -1;}
 	//NE
 	n_idx = idx - dim_x + 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x - 1)){indices[3] = n_idx;} else {indices[3] = -1;}
 	//E
 	n_idx = idx + 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x)){indices[4] = n_idx;} else {indices[4] = -1;}
 	//SE
 	n_idx = idx + dim_x + 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices[5] = n_idx;} else {indices[5] = -1;}
 	//S
 	n_idx = idx + dim_x;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices[6] = n_idx;} else {indices[6] = -1;}
 	//SW
 	n_idx = idx + dim_x - 1;
-	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices.push_back(n_idx);} else {indices.push_back(-1);}
-	return indices;
+	if((n_idx < max_idx) & (n_idx/dim_x == idx/dim_x + 1)){indices[7] = n_idx;} else {indices[7] = -1;}
 }
 
-void WFC::update_wave_neigs(unsigned int wave_idx,unsigned int type_idx,size_t dim_x, size_t dim_y)
+bool WFCSolver::update_wave_neigs(unsigned int wave_idx,unsigned int type_idx)
+{
+	if(options.precision == WeightPrecision::float32) { return update_wave_neigs(wave_function_float,wave_idx,type_idx); }
+	return update_wave_neigs(wave_function,wave_idx,type_idx);
+}
+
+template <typename Real>
+bool WFCSolver::update_wave_neigs(BasicWaveFunction<Real>& weights, unsigned int wave_idx, unsigned int type_idx)
 {
 	//std::cout << "|||||||||||| update_wave_neigs ||||||||||||" << std::endl;
 	//std::cout << "INPUTS idx: " << wave_idx << " ,type_idx: " << type_idx << ",dim_x: " << dim_x << " ,dim_y: " << dim_y << std::endl; 
-	size_t max_idx = dim_x*dim_y;
-	unsigned int queue_idx = 0;
-	unsigned int neig_i = 0; // Specifies index in neig_probs
-	for(unsigned int i : get_neighbours(wave_idx, dim_x, dim_y))
+	size_t n_types = model->get_n_patterns();
+	if(type_idx >= n_types) { throw std::out_of_range("update_wave_neigs: type_idx >= number of patterns"); }
+	uint8_t valid = grid.mask(wave_idx);
+	const int* offsets = grid.offsets(wave_idx);
+	for(unsigned int neig_i = 0; neig_i < 8; neig_i++) // neig_i specifies index in neig_probs
 	{
-		if(i < max_idx) // Check whether neighbour is valid
+		unsigned int i = wave_idx + offsets[neig_i];
+		if((valid >> neig_i & 1) && !weights.is_collapsed(i)) // Check whether neighbour is valid and not collapsed yet
 		{
 			//std::cout << "UPDATING i=" << i << " ......" << std::endl;
-			// prob vector of type idx for neighbour #neig_i: neig_probs[tile_types[type_idx]][neig_i];	
-			std::vector<double> probs1;
-			try{ probs1 = neig_probs.at(tile_types[type_idx])[neig_i]; } catch(std::exception& e) { std::cerr << "update_wave_neigs: neig_probs out of range."; }
-			if(i >= wave_function.size()) { throw std::out_of_range("update_wave_neigs: i >= wave_function.size()"); }
-			std::vector<double> probs2 = wave_function[i];
-			//print_vector(probs1); std::cout << " ; "; print_vector(probs2); std::cout << std::endl;
-			std::vector<double> new_wave = dot_and_normalize(probs1,probs2);
-			queue_idx = 0;
-			for(auto it = queue.begin(); it != queue.end(); it++){ queue_idx++; if(it->second == wave_idx){ break;} } //Find queue idx corresponding to wave_idx
-			queue[queue_idx].first = shannon_entropy(new_wave);// Update shannon entropy for queue
-			wave_function[i] = new_wave;
-		}
-		neig_i++;
+			// prob vector of type idx for neighbour #neig_i
+			const Real* probs1;
+			const Real* log_probs1;
+			model->neig_rows(type_idx,neig_i,probs1,log_probs1);
+			if(i >= weights.size()) { throw std::out_of_range("update_wave_neigs: i >= wave_function.size()"); }
+			//WFCModel::print_vector(probs1,n_types); std::cout << " ; "; WFCModel::print_vector(weights[i],n_types); std::cout << std::endl;
+			save_cell(i);
+			if(!multiply_wave(weights,i,probs1,log_probs1)) { return false; }
+			WFC_PROFILE_SCOPE(profiler,ProfilePhase::entropy);
+			WFC_PROFILE_COUNT(profiler,entropy_updates);
+			queue.update(i,weights.entropy(i));// Update shannon entropy for queue (O(1) from the running sums)
+		}
 	}
 	//std::cout << "-------> ready" << std::endl;
+	return true;
 }
 
-std::vector<double> WFC::dot_and_normalize(std::vector<double> probs1, std::vector<double> probs2) const
+// multiply_log of k for rows of n weights of either precision, compiled for n if it is small (see SimdKernels::multiply_log_for)
+static inline void multiply_log(const SimdKernels& k, const double* q, const double* log_q, double* w, double* log_w, size_t n, double* sum, double* sum_wlogw)
 {
-	//std::cout << "|||||||||||| dot_and_normalize ||||||||||||" << std::endl;
-	std::vector<double> norm_dot;
-	//checks whether probs1 and probs2 have same size
-	if(probs1.size() != probs2.size()) { throw std::invalid_argument("dot_and_normalize: Vectors not of same size! "); }
-	// Dot product
-	double sum = 0;
-	double prod;
-	for(unsigned int i = 0; i < probs1.size(); i++)
+	k.multiply_log_for(n)(q,log_q,w,log_w,n,sum,sum_wlogw);
+}
+
+static inline void multiply_log(const SimdKernels& k, const float* q, const float* log_q, float* w, float* log_w, size_t n, double* sum, double* sum_wlogw)
+{
+	k.multiply_log_float_for(n)(q,log_q,w,log_w,n,sum,sum_wlogw);
+}
+
+bool WFCSolver::multiply_wave(unsigned int wave_idx, const double* probs1, const double* log_probs1)
+{
+	return multiply_wave(wave_function,wave_idx,probs1,log_probs1);
+}
+
+template <typename Real>
+bool WFCSolver::multiply_wave(BasicWaveFunction<Real>& weights, unsigned int wave_idx, const Real* probs1, const Real* log_probs1)
+{
+	//std::cout << "|||||||||||| multiply_wave ||||||||||||" << std::endl;
+	size_t n_types = weights.get_n_types();
+	Real* probs2 = weights[wave_idx];
+	// Dot product (elementwise, written back to probs2) and running sums in one pass
+	double sum, sum_wlogw;
+	multiply_log(*kernels,probs1,log_probs1,probs2,weights.log_weights(wave_idx),n_types,&sum,&sum_wlogw);
+	if(std::isnan(sum) | std::isnan(sum_wlogw))
 	{
-		prod = probs1[i]*probs2[i];
-		sum += prod;
-		norm_dot.push_back(prod);
+		// The factors go into the message: the solver does not write to the console
+		std::ostringstream message;
+		message << "multiply_wave: nan value in wave. This should not happen. Bug in code? ";
+		WFCModel::print_vector(message,probs1,n_types); message << " -----> "; WFCModel::print_vector(message,probs2,n_types);
+		throw std::invalid_argument(message.str());
 	}
 	//If conflict occured, i.e. all tile types getting 0 probability
 	if(sum <= 0)
 	{
-		std::cout << "Contradiction occured! Setting uniform probability for all types" << std::endl;
-		for(unsigned int j = 0; j < probs1.size(); j++) { norm_dot[j] = 1.0/probs1.size(); }
+		stats.contradictions++;
+		if(!repair_contradictions) { return false; }
+		WFC_LOG(LogLevel::debug,"Contradiction occured! Setting uniform probability for all types");
+		weights.set_uniform(wave_idx);
+		domains.fill(wave_idx);
 	}
-	//else: Normalization
 	else
 	{
-		for(unsigned int j = 0; j < probs1.size(); j++) { norm_dot[j] = norm_dot[j]/sum; }		
+		weights.set_sums(wave_idx,sum,sum_wlogw);
 	}
+	return true;
+}
+
+// Whether allowed contains every type of domain
+static bool covers(const uint64_t* allowed, const uint64_t* domain, size_t words)
+{
+	for(size_t w = 0; w < words; w++) { if(domain[w] & ~allowed[w]) { return false; } }
+	return true;
+}
 
-	if(std::isnan(norm_dot[0]) | std::isnan(norm_dot[1]) | std::isnan(norm_dot[2]) )
+template <size_t Words>
+void WFCSolver::collect_support(unsigned int cur, unsigned int neig_i, unsigned int neig)
+{
+	const size_t words = Words ? Words : domains.words();
+	const uint64_t* domain = domains[cur];
+	const uint64_t* neig_domain = domains[neig];
+	std::fill(allowed.begin(),allowed.end(),0);
+	if(domains.count(neig) < domains.count(cur)*std::min<size_t>(words,4))
 	{
-		print_vector(probs1); std::cout << " * "; print_vector(probs2); std::cout << " -----> "; print_vector(norm_dot); std::cout << std::endl;
-		throw std::invalid_argument("dot_and_normalize: nan value in norm_dot. This should not happen. Bug in code?");
+		// Backward: for every type of the neighbour, look for one type of cur it may be next to. The lists are
+		// symmetric, so the types that may be in the opposite direction of the neighbour's type are searched.
+		unsigned int opposite = (neig_i + 4) % 8;
+		for(size_t w = 0; w < words; w++)
+		{
+			for(uint64_t bits = neig_domain[w]; bits; bits &= bits - 1)
+			{
+				unsigned int type_idx = w*64 + __builtin_ctzll(bits);
+				const unsigned int* end = model->compatible_end(type_idx,opposite);
+				for(const unsigned int* q = model->compatible_begin(type_idx,opposite); q != end; q++)
+				{
+					if(domain[*q/64] >> (*q%64) & 1) { allowed[w] |= bits & (~bits + 1); break; }
+				}
+			}
+		}
+		return;
+	}
+	// Forward: all types that are supported by at least one type still allowed in cur (bit-parallel OR)
+	unsigned int n_added = 0;
+	bool covered = false;
+	for(size_t w = 0; w < words && !covered; w++)
+	{
+		uint64_t bits = domain[w];
+		while(bits && !covered)
+		{
+			unsigned int type_idx = w*64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			// Short compatibility lists (many patterns) are cheaper to walk than the whole bitset
+			const unsigned int* begin = model->compatible_begin(type_idx,neig_i);
+			const unsigned int* end = model->compatible_end(type_idx,neig_i);
+			if((size_t)(end - begin) < words)
+			{
+				for(const unsigned int* q = begin; q != end; q++) { allowed[*q/64] |= (uint64_t)1 << (*q%64); }
+			}
+			else
+			{
+				const uint64_t* mask = model->adjacency_mask(type_idx,neig_i);
+				for(size_t k = 0; k < words; k++) { allowed[k] |= mask[k]; }
+			}
+			// Stop early once the whole domain of the neighbour is supported, it cannot change anymore. With a single
+			// word the check is one AND, so it is done every time.
+			covered = (words == 1 || ++n_added % 16 == 0) && covers(allowed.data(),neig_domain,words);
+		}
+	}
+}
+
+bool WFCSolver::propagate()
+{
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::propagate);
+	switch(domains.words())
+	{
+		case 1: return propagate_words<1>();
+		case 2: return propagate_words<2>();
+		case 4: return propagate_words<4>();
+		default: return propagate_words<0>();
+	}
+}
+
+template <size_t Words>
+bool WFCSolver::propagate_words()
+{
+	size_t steps = 0;
+	uint8_t directions = model->get_propagation_directions();
+	while(!worklist.empty())
+	{
+		unsigned int cur = worklist.pop();
+		steps++;
+		uint8_t valid = grid.mask(cur) & directions;
+		const int* offsets = grid.offsets(cur);
+		for(unsigned int neig_i = 0; neig_i < 8; neig_i++) // Direction from cur to the neighbour
+		{
+			unsigned int i = cur + offsets[neig_i];
+			if(!(valid >> neig_i & 1) || !queue.contains(i)) { continue; } // Collapsed cells are final
+			collect_support<Words>(cur,neig_i,i);
+			// Check for contradiction before applying the change
+			if(!has_support<Words>(i,allowed.data()))
+			{
+				stats.contradictions++;
+				if(!repair_contradictions)
+				{
+					worklist.clear();
+					stats.steps += steps;
+					stats.max_steps = std::max(stats.max_steps,steps);
+					return false;
+				}
+				WFC_LOG(LogLevel::debug,"Contradiction occured! Keeping the domain of the neighbour unchanged");
+			}
+			else if(restrict_cell<Words>(i,allowed.data()) > 0)
+			{
+				worklist.push(i);
+			}
+		}
+	}
+	stats.steps += steps;
+	stats.max_steps = std::max(stats.max_steps,steps);
+	return true;
+}
+
+template <size_t Words>
+bool WFCSolver::has_support(unsigned int wave_idx, const uint64_t* allowed) const
+{
+	const size_t words = Words ? Words : domains.words();
+	const uint64_t* domain = domains[wave_idx];
+	for(size_t w = 0; w < words; w++)
+	{
+		uint64_t remaining = domain[w] & allowed[w];
+		if(options.mode == SolverMode::bitset) { if(remaining) { return true; } continue; }
+		// Probabilistic mode: a type can also have lost all weight to the neighbour probabilities
+		while(remaining)
+		{
+			if(has_weight(wave_idx,w*64 + __builtin_ctzll(remaining))) { return true; }
+			remaining &= remaining - 1;
+		}
+	}
+	return false;
+}
+
+bool WFCSolver::has_support(unsigned int wave_idx, const uint64_t* allowed) const
+{
+	return has_support<0>(wave_idx,allowed);
+}
+
+size_t WFCSolver::restrict_cell(unsigned int wave_idx, const uint64_t* allowed)
+{
+	return restrict_cell<0>(wave_idx,allowed);
+}
+
+template <size_t Words>
+size_t WFCSolver::restrict_cell(unsigned int wave_idx, const uint64_t* allowed)
+{
+	save_cell(wave_idx);
+	if(options.mode == SolverMode::bitset)
+	{
+		size_t removed = domains.restrict_to<Words>(wave_idx,allowed);
+		if(removed > 0)
+		{
+			WFC_PROFILE_SCOPE(profiler,ProfilePhase::entropy);
+			WFC_PROFILE_COUNT(profiler,entropy_updates);
+			queue.update(wave_idx,domains.entropy(wave_idx));
+		}
+		return removed;
 	}
-	return norm_dot;
+	// Probabilistic mode: every removed type also loses its weight
+	size_t removed = options.precision == WeightPrecision::float32 ? ban_types<Words>(wave_function_float,wave_idx,allowed)
+		: ban_types<Words>(wave_function,wave_idx,allowed);
+	if(removed == 0) { return 0; }
+	WFC_PROFILE_SCOPE(profiler,ProfilePhase::entropy);
+	WFC_PROFILE_COUNT(profiler,entropy_updates);
+	queue.update(wave_idx,cell_entropy(wave_idx));
+	return removed;
 }
 
-StringMap WFC::create_stringMap(size_t dim_x, size_t dim_y) const
+template <size_t Words, typename Real>
+size_t WFCSolver::ban_types(BasicWaveFunction<Real>& weights, unsigned int wave_idx, const uint64_t* allowed)
 {
-	StringMap sm(dim_x,dim_y);
-	int max = 0;
-	int type_idx = 0;
-	unsigned int cur_idx = 0;
-	for(std::vector<double> wave_i : wave_function)
+	const size_t words = Words ? Words : domains.words();
+	const uint64_t* domain = domains[wave_idx];
+	size_t removed = 0;
+	for(size_t w = 0; w < words; w++)
 	{
-		for(double type_value : wave_i)
+		uint64_t banned = domain[w] & ~allowed[w];
+		while(banned)
 		{
-			if(type_value > max) {max = type_value; type_idx = cur_idx; } // Find the type_idx with the largest prob
-			max = 0;
-			cur_idx++;			
+			size_t type_idx = w*64 + __builtin_ctzll(banned);
+			banned &= banned - 1;
+			domains.ban(wave_idx,type_idx);
+			weights.ban(wave_idx,type_idx);
+			removed++;
 		}
-		cur_idx = 0;
-		if(type_idx < tile_types.size())
+	}
+	// has_support was checked before, so a sum <= 0 can only be left over by cancellation in the running sum
+	if(removed > 0 && weights.sum(wave_idx) <= 0) { weights.update_sums(wave_idx); }
+	return removed;
+}
+
+// Type with the largest weight in cell wave_idx (the first one on ties)
+template <typename Real>
+static size_t heaviest_type(const BasicWaveFunction<Real>& weights, size_t wave_idx)
+{
+	const Real* wave_i = weights[wave_idx];
+	size_t type_idx = 0;
+	for(size_t cur_idx = 1; cur_idx < weights.get_n_types(); cur_idx++)
+	{
+		if(wave_i[cur_idx] > wave_i[type_idx]) { type_idx = cur_idx; } // Find the type_idx with the largest prob
+	}
+	return type_idx;
+}
+
+StringMap WFCSolver::create_stringMap(size_t dim_x, size_t dim_y) const
+{
+	StringMap sm(0,0);
+	create_stringMap(sm,dim_x,dim_y);
+	return sm;
+}
+
+void WFCSolver::create_stringMap(StringMap& sm, size_t dim_x, size_t dim_y) const
+{
+	sm.reset(dim_x,dim_y,model->get_types());
+	if(options.order != CollapseOrder::entropy)
+	{
+		for(size_t wave_idx = 0; wave_idx < dim_x*dim_y; wave_idx++) { sm.push_back(model->tile_of(scan_types[wave_idx])); }
+		return;
+	}
+	if(options.mode == SolverMode::bitset)
+	{
+		for(size_t wave_idx = 0; wave_idx < domains.size(); wave_idx++)
 		{
-			sm.push_back(tile_types[type_idx]);	
+			size_t type_idx = domains.first_type(wave_idx);
+			if(type_idx >= model->get_n_patterns()) { throw std::out_of_range("create_stringMap: type_idx >= number of patterns"); }
+			sm.push_back(model->tile_of(type_idx));
+		}
+		return;
+	}
+	size_t n_cells = options.precision == WeightPrecision::float32 ? wave_function_float.size() : wave_function.size();
+	for(size_t wave_idx = 0; wave_idx < n_cells; wave_idx++)
+	{
+		size_t type_idx = options.precision == WeightPrecision::float32 ? heaviest_type(wave_function_float,wave_idx) : heaviest_type(wave_function,wave_idx);
+		if(type_idx < model->get_n_types())
+		{
+			sm.push_back((tile_id)type_idx);	
 		}
 		else
 		{
 			throw std::out_of_range("create_stringMap: type_idx >= tile_types.size()");
 		}
 	}
+}
+
+std::vector<StringMap> WFC::generate_batch(size_t n, size_t dim_x, size_t dim_y, uint64_t seed, size_t n_threads)
+{
+	std::vector<uint64_t> seeds(n);
+	for(size_t i = 0; i < n; i++) { seeds[i] = Xoshiro256::split(seed,i); }
+	return generate_batch(n,dim_x,dim_y,seeds,n_threads);
+}
+
+std::vector<StringMap> WFC::generate_batch(size_t n, size_t dim_x, size_t dim_y, const std::vector<uint64_t>& seeds, size_t n_threads)
+{
+	if(!seeds.empty() && seeds.size() != n) { throw std::invalid_argument("generate_batch: seeds.size() != n"); }
+	prepare_pool(n_threads);
+	uint64_t clock_seed = std::chrono::system_clock::now().time_since_epoch().count();
+	std::vector<StringMap> maps(n,StringMap(dim_x,dim_y));
+	pool->run(n,[&](size_t map_idx, size_t thread_idx)
+	{
+		uint64_t seed = seeds.empty() ? Xoshiro256::split(clock_seed,map_idx) : seeds[map_idx];
+		maps[map_idx] = solvers[thread_idx]->generate_map(dim_x,dim_y,seed);
+	});
+	return maps;
+}
+
+StringMap WFC::generate_map_parallel(size_t dim_x, size_t dim_y, uint64_t seed, size_t region_size, size_t n_threads)
+{
+	SeamLattice lattice(get_shared_model(),region_size,seed);
+	prepare_pool(n_threads);
+	size_t regions_x = (dim_x + region_size - 1)/region_size;
+	size_t regions_y = (dim_y + region_size - 1)/region_size;
+	std::vector<tile_id> ids(dim_x*dim_y);
+	pool->run(regions_x*regions_y,[&](size_t region_idx, size_t thread_idx)
+	{
+		size_t i = region_idx % regions_x, j = region_idx / regions_x;
+		size_t x0 = i*region_size, y0 = j*region_size;
+		// Include the seams to the next regions, if there are any
+		size_t width = std::min(region_size + 1,dim_x - x0);
+		size_t height = std::min(region_size + 1,dim_y - y0);
+		std::vector<tile_id> region, scratch;
+		lattice.region(*solvers[thread_idx],i,j,width,height,region,scratch);
+		// Regions write disjoint cells: the seams to the next regions are written by those regions
+		size_t keep_x = std::min(region_size,width), keep_y = std::min(region_size,height);
+		for(size_t y = 0; y < keep_y; y++)
+		{
+			std::copy(region.begin() + y*width, region.begin() + y*width + keep_x, ids.begin() + (y0 + y)*dim_x + x0);
+		}
+	});
+	StringMap sm(dim_x,dim_y,get_model().get_types());
+	for(tile_id id : ids) { sm.push_back(id); }
 	return sm;
 }
 
+void WFC::prepare_pool(size_t n_threads)
+{
+	if(n_threads == 0) { n_threads = ThreadPool::hardware_threads(); }
+	if(!pool || pool->size() != n_threads)
+	{
+		pool.reset(new ThreadPool(n_threads));
+		solvers.clear();
+	}
+	// One solver per thread, all of them reading the same model
+	while(solvers.size() < n_threads) { solvers.emplace_back(new WFCSolver(get_shared_model(),get_options())); }
+}
+
 // prints out n randomly generated maps Based on input_map 
 void test_wfc(std::string input_map,size_t dim_x, size_t dim_y, int n)
 {
 	WFC* wfc = new WFC(input_map);
+	StringMap sm(0,0);
 	for(unsigned int i = 0; i < n; i++)
 	{
-		StringMap sm = wfc->generate_map(dim_x,dim_y);
+		wfc->generate_map_into(sm,dim_x,dim_y,(uint64_t)std::chrono::system_clock::now().time_since_epoch().count());
 		sm.print();
 	}
 } 
@@ -7,10 +7,30 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <limits>
+#include <stdint.h>
 #include <random>
 #include <math.h>
 #include <chrono>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <thread>
+#include <stdexcept>
 #include "exceptions.hpp"
+#include "entropy_queue.hpp"
+#include "wave_function.hpp"
+#include "domains.hpp"
+#include "worklist.hpp"
+#include "grid.hpp"
+#include "trail.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "random.hpp"
+#include "profiler.hpp"
+#include "logger.hpp"
 /*
 HOW TO USE:
 StringMap
@@ -24,6 +44,7 @@ StringMap
 		StringMap::print
 		StringMap::erase
 		StringMap::write_to_file
+		StringMap::write_binary
 
 WFC
 	Description
@@ -36,8 +57,13 @@ WFC
 		Some tweaking in the input sample file might help with
 		obtaining satisfying results.		
 
+		The learned model (WFCModel) is immutable and shared; the generation state lives in WFCSolver, which WFC derives from.
+		The model learns either which tiles may be neighbours or, with the overlapping model, N x N patterns (see LearningMode).
+
 	The functions that are worth interacting with outside the class:
 		WFC::generate_map
+		WFC::generate_batch
+		WFC::generate_async
 		test_wfc()
 		WFC::print_* (all print functions are especially useful for debugging)
 	
@@ -45,10 +71,14 @@ WFC
 		WFC* wfc = new WFC("Maps/input_map_2.txt");
 		StringMap sm = wfc->generate_map(60,60);
 		sm.write_to_file("generated_map.txt"):
+		std::vector<StringMap> maps = wfc->generate_batch(1000,60,60); // On all cores
+		GenerationHandle handle = wfc->generate_async(256,256,seed); // In the background, handle.get() waits for the map
 	Example of testing whether randomizing works (all the maps should be completely different)
 		test_wfc("Maps/input_map.txt",80,50,10); //prints the maps to terminal (zoom out in terminal to see the patterns)
 */
 
+typedef uint16_t tile_id; // Index of a tile type in StringMap::types. The largest value is never a tile (WFCSolver::free_cell)
+
 class StringMap
 {
 public:
@@ -56,6 +86,13 @@ public:
 	StringMap(std::string filename); 
 	// Second constructor with parameters as dimensions 
 	StringMap(size_t dim_x, size_t dim_y) : width(dim_x), height(dim_y) {}
+	// Third constructor with dimensions and the tile types (palette) that tile ids pushed with push_back(tile_id) refer to
+	StringMap(size_t dim_x, size_t dim_y, const std::vector<std::string>& palette);
+	/*
+	* Empties the map and sets it up like the third constructor, keeping the allocated memory. Does not allocate
+	* if the map held as many cells with the same palette before.
+	*/
+	void reset(size_t dim_x, size_t dim_y, const std::vector<std::string>& palette);
  
  	/* Creates and stores the StringMap from file. 
  	* Parameters:
@@ -77,15 +114,33 @@ public:
 	*/
 	std::vector<double> calculate_frequency();
 	/*
-	* Analyzes the data and returns all the different Tile types in vector of std::string (order is based on occurance)
+	* Returns all the different Tile types in vector of std::string (order is based on occurance)
+	* Tile types are interned while importing/pushing, so this does not scan the data.
 	*/
-	std::vector<std::string> calculate_types();
+	std::vector<std::string> calculate_types() const { return types; }
 	/*
-	*  Inserts a new string element on the back of the data
+	*  Inserts a new string element on the back of the data. New tile types are added to types.
 	*/
-	void push_back(std::string str) { data.push_back(str); }
+	void push_back(const std::string& str) { data.push_back(intern(str)); }
+	/*
+	*  Inserts a tile id (index to types) on the back of the data
+	*/
+	void push_back(tile_id id) { data.push_back(id); }
 
-	std::vector<std::string> get_types() const { return types; }
+	const std::vector<std::string>& get_types() const { return types; }
+	/*
+	*  Returns the tile id (index to types) of tile idx
+	*/
+	tile_id get_id(unsigned int idx) const { return data[idx]; }
+	const std::vector<tile_id>& get_ids() const { return data; }
+	/*
+	*  Sets tile idx to id (index to types)
+	*/
+	void set_id(unsigned int idx, tile_id id) { data[idx] = id; }
+	/*
+	*  Returns the tile id of name, adding it to types if it is new
+	*/
+	tile_id add_type(const std::string& name) { return intern(name); }
 
 	std::map<std::string,int> get_type_map() const;
 
@@ -94,14 +149,27 @@ public:
 
 	void print_types();
 
-	std::string operator[](unsigned int idx) {return data[idx];}
+	std::string operator[](unsigned int idx) const {return types[data[idx]];}
 	/*
 	* Writes the whole StringMap to a file. Each element separated by ";" and each row separated by \n
 	*/
 	void write_to_file(std::string filename) const;
+	/*
+	* Writes the whole StringMap to a file in the compact binary format (see binary_map.hpp).
+	* import and the filename constructor recognize both formats.
+	*/
+	void write_binary(std::string filename) const;
 private:
-	std::vector<std::string> data;
+	/*
+	*  Returns the tile id of str (len characters, need not be null-terminated), adding it to types if it has
+	*  not been seen before. Does not allocate unless the type is new.
+	*/
+	tile_id intern(const char* str, size_t len);
+	tile_id intern(const std::string& str) { return intern(str.data(),str.size()); }
+
+	std::vector<tile_id> data;
 	std::vector<std::string> types;
+	std::vector<uint32_t> type_slots; // Inverse of types: open addressing hash table of tile id + 1 (0: empty), size is a power of two
 	size_t width;
 	size_t height;
 };
@@ -115,16 +183,261 @@ private:
 //5. Update all other elements according to neighbor_prob
 //6. Repeat 4-5 until all Tiles have been set to one Tile type
 
+/*
+* How WFC::generate_map represents and updates the possible tile types of each cell
+*	probabilistic: every cell holds a weight per tile type (WaveFunction). Collapsing a cell multiplies the weights
+*		of its 8 neighbours with neig_probs. The allowed types are tracked in Domains as well and propagated like in
+*		bitset mode, so a type that can no longer be placed next to its surroundings gets weight 0 map-wide.
+*	bitset: every cell holds a bitset of the tile types that are still allowed (Domains), weighted by freq_vector.
+*		Two types may be neighbours in a direction if the corresponding entry of neig_probs is non-zero. Collapsing
+*		a cell removes the types that lost all support from the domains around it, and keeps doing so (AC-3 style
+*		worklist) until no domain changes anymore.
+*/
+enum class SolverMode { probabilistic, bitset };
+
+/*
+* What WFC::generate_map does when a cell runs out of possible tile types
+*	repair: the cell is patched and generation goes on (probabilistic mode gives the cell uniform weights, bitset
+*		mode keeps the domain of the cell unchanged). Fast, but the map shows visible seams.
+*	restart: the generation is started over with new random numbers.
+*	backtrack: the changes since the last collapse are undone (Trail), the chosen type is banned from that cell and
+*		generation goes on. If there is nothing left to undo, the generation restarts.
+*	restart and backtrack give up after WFCOptions::max_restarts restarts and repair the last attempt instead.
+*/
+enum class ContradictionPolicy { repair, restart, backtrack };
+
+/*
+* In which order WFC::generate_map collapses the cells
+*	entropy: the cell with the lowest entropy next, with full propagation after every collapse (see SolverMode)
+*	scanline: row by row, left to right. Every cell is sampled once from the model weights conditioned on the
+*		neighbours that are already set (W, NW, N and NE, plus given cells and, with wrap, the cells across the
+*		border): probabilistic mode multiplies their neig_probs, bitset mode intersects their adjacency bitsets.
+*		There is no queue and no propagation, and only about two rows of the map are touched at a time, so it is
+*		several times faster, but a cell can run out of types because of the neighbours not set yet. Such a
+*		contradiction is repaired by sampling the cell without its diagonal neighbours, then without any (a seam),
+*		or restarts the map (restart and backtrack, as there is nothing to backtrack).
+*	hilbert: like scanline, along a Hilbert curve, conditioned on all neighbours already set. The cells between
+*		two set neighbours contradict more often.
+*	scanline and hilbert need LearningMode::adjacent: overlapping patterns constrain each other too much for a
+*		single pass.
+*/
+enum class CollapseOrder { entropy, scanline, hilbert };
+
+/*
+* What WFCModel learns from the input sample. The solver picks one pattern per cell; the tile of a cell is the
+* top left tile of its pattern.
+*	adjacent: every tile type is a 1x1 pattern. Learns how often each type is the neighbour of each type in the
+*		8 directions (neig_probs). Works with both solver modes.
+*	overlapping: the patterns are the n x n windows of the sample (see Patterns), and two patterns may be
+*		neighbours if they agree where they overlap. Reproduces larger structures of the sample, but there can be
+*		thousands of patterns, so it needs SolverMode::bitset.
+*/
+enum class LearningMode { adjacent, overlapping };
+
+/*
+* Number type of the weights of SolverMode::probabilistic (see BasicWaveFunction)
+*	float64: double weights (default).
+*	float32: float weights. Halves the rows of the wave function and the neighbour probabilities read per collapse,
+*		so twice the map fits into the caches. Every product is rounded to float, so the maps differ from float64
+*		maps of the same seed, but are reproducible on every platform as well. The running entropy sums stay double.
+*		Weights below about 1e-38 lose precision and can underflow to 0 (float has 8 instead of 11 exponent bits),
+*		which is then handled like a contradiction.
+*	Only the probabilistic solver with CollapseOrder::entropy keeps weights per cell; the others ignore it.
+*/
+enum class WeightPrecision { float64, float32 };
+
+struct ModelOptions
+{
+	LearningMode learning;
+	size_t pattern_size; // n of the n x n patterns (overlapping)
+	bool symmetry; // Add the rotations and reflections of every pattern (overlapping)
+	bool periodic_input; // Take windows that wrap around the border of the sample as well (overlapping)
+	ModelOptions() : learning(LearningMode::adjacent), pattern_size(3), symmetry(false), periodic_input(false) {}
+};
+
+/*
+* Options of WFC, given to the constructor
+*/
+struct WFCOptions
+{
+	SolverMode mode;
+	ContradictionPolicy contradiction;
+	CollapseOrder order;
+	unsigned int max_restarts; // Per generate_map call
+	size_t max_backtracks; // Per attempt, then the attempt restarts
+	size_t max_trail_bytes; // Memory bound of the undo log. Older collapses become final when it is exceeded.
+	bool wrap; // Toroidal map: the borders wrap around, so the map tiles seamlessly (see Grid)
+	bool trace; // Record trace events of every timed phase (only with WFC_PROFILE, see Profiler)
+	WeightPrecision precision; // Of the weights of SolverMode::probabilistic
+	WFCOptions() : mode(SolverMode::probabilistic), contradiction(ContradictionPolicy::repair), order(CollapseOrder::entropy), max_restarts(10),
+		max_backtracks(1000), max_trail_bytes(64 << 20), wrap(false), trace(false), precision(WeightPrecision::float64) {}
+};
+
+/*
+* Counters of the propagation stage of the last WFC::generate_map call
+*/
+struct PropagationStats
+{
+	size_t collapses; // Collapsed cells
+	size_t steps; // Cells popped from the worklist in total
+	size_t max_steps; // Most cells popped after a single collapse
+	size_t contradictions; // Cells whose domain or weights would have become empty
+	size_t restarts; // Attempts that were given up (ContradictionPolicy::restart and backtrack)
+	size_t backtracks; // Undone collapses (ContradictionPolicy::backtrack)
+	PropagationStats() : collapses(0), steps(0), max_steps(0), contradictions(0), restarts(0), backtracks(0) {}
+	double steps_per_collapse() const { return collapses > 0 ? (double)steps/collapses : 0; }
+};
+
+/*
+* Statistics of one WFC::generate_map call: the propagation counters and, if built with WFC_PROFILE, the entropy
+* updates and the calls and seconds of every phase (see Profiler). Dumps as JSON or as Chrome trace events.
+*/
+struct GenerationStats
+{
+	size_t dim_x;
+	size_t dim_y;
+	uint64_t seed;
+	PropagationStats propagation;
+	bool profiled; // Built with WFC_PROFILE, i.e. the fields below are filled in
+	size_t entropy_updates;
+	PhaseStats phases[(int)ProfilePhase::count];
+	std::vector<TraceEvent> trace; // WFCOptions::trace
+	GenerationStats() : dim_x(0), dim_y(0), seed(0), profiled(false), entropy_updates(0) {}
+	const PhaseStats& phase(ProfilePhase p) const { return phases[(int)p]; }
+	std::string to_json() const;
+	/*
+ 	* Writes trace as a Chrome trace ({"traceEvents": [...]}, open in chrome://tracing or Perfetto). tid tells maps
+ 	* of different threads apart when several traces are merged.
+	*/
+	void write_chrome_trace(std::ostream& os, unsigned int tid = 0) const;
+};
+
+/*
+* A cell that got its tile during generation (see WFCSolver::take_collapsed)
+*/
+struct CellUpdate
+{
+	unsigned int cell; // y*dim_x + x
+	tile_id tile; // Tile id of the model (and of the finished map)
+};
+
+/*
+* Passed to the progress callback of WFC::generate_async
+*/
+struct GenerationProgress
+{
+	size_t collapsed; // Cells set in the current attempt
+	size_t total; // dim_x*dim_y
+	unsigned int attempt; // Increased by every restart: the cells delivered with an earlier attempt are void
+	bool finished; // Last callback, the map is complete
+	std::vector<CellUpdate> cells; // Set since the previous callback. A backtracked cell comes again with its new tile.
+	GenerationProgress() : collapsed(0), total(0), attempt(0), finished(false) {}
+};
+
+/*
+* Flag for abandoning generations. Copies share the flag, so one token can cancel any number of generations.
+*/
+class CancellationToken
+{
+public:
+	CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+	void cancel() { flag->store(true,std::memory_order_relaxed); }
+	bool cancelled() const { return flag->load(std::memory_order_relaxed); }
+private:
+	std::shared_ptr<std::atomic<bool>> flag;
+};
+
+/*
+* Thrown by the future of a cancelled generation
+*/
+class generation_cancelled : public std::runtime_error
+{
+public:
+	generation_cancelled() : std::runtime_error("generation cancelled") {}
+};
+
+/*
+* Options of WFC::generate_async
+*/
+struct AsyncOptions
+{
+	std::function<void(const GenerationProgress&)> on_progress; // Called on the generating thread, may be empty
+	size_t progress_cells; // Cells per progress callback (fewer in the last one, or if progress_interval passes first)
+	std::chrono::milliseconds progress_interval; // Longest time between two progress callbacks
+	CancellationToken cancel; // Checked between steps of about a millisecond. Can be shared by several generations.
+	std::vector<tile_id> fixed; // Given tiles (see WFCSolver::generate_map)
+	AsyncOptions() : progress_cells(4096), progress_interval(50) {}
+};
+
+/*
+* Handle of a map being generated on its own thread (WFC::generate_async). The destructor cancels the generation and
+* waits for the thread, so dropping the handle of a stale request abandons it.
+*/
+class GenerationHandle
+{
+public:
+	GenerationHandle() {}
+	/*
+ 	* token cancels only this generation (unlike AsyncOptions::cancel)
+	*/
+	GenerationHandle(std::future<StringMap> result, CancellationToken token, std::thread thread) : result(std::move(result)), token(token), thread(std::move(thread)) {}
+	GenerationHandle(GenerationHandle&& other) : result(std::move(other.result)), token(other.token), thread(std::move(other.thread)) {}
+	GenerationHandle& operator=(GenerationHandle&& other);
+	~GenerationHandle() { stop(); }
+	void cancel() { token.cancel(); }
+	/*
+ 	* Whether get() returns without waiting
+	*/
+	bool ready() const { return result.valid() && result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+	/*
+ 	* Waits for the map. Rethrows what the generation threw, generation_cancelled if it was cancelled. Only once.
+	*/
+	StringMap get() { return result.get(); }
+	std::future<StringMap>& get_future() { return result; }
+private:
+	void stop();
+
+	std::future<StringMap> result;
+	CancellationToken token;
+	std::thread thread;
+};
 
-class WFC
+/*
+* Tile types, patterns, frequencies and neighbour probabilities learned from an input sample (see LearningMode).
+* Immutable after construction, so one model can be shared (std::shared_ptr<const WFCModel>) by any number of
+* WFCSolver instances, also across threads.
+*/
+class WFCModel
 {
 public:
 	/*
  	* Constructor
  	* Takes filename of input map (same file format as StringMap and TileMap uses) as parameter.
- 	* Initializes internal variables based on input map.
+ 	* Learns the model from the input map as selected by options.
 	*/		
-	WFC(std::string filename);
+	WFCModel(std::string filename, ModelOptions options = ModelOptions());
+	/*
+ 	* Writes the learned model (types, frequencies, neighbour tensor, adjacency bitsets, patterns) to a compiled model
+ 	* file, tagged with key (see cache_key). Throws std::runtime_error if the file cannot be written. Every call writes
+ 	* its own temporary file next to filename and renames it, so that concurrent saves of the same file never expose
+ 	* a partially written one.
+	*/
+	void save(std::string filename, uint64_t key = 0) const;
+	/*
+ 	* Reads a compiled model file with one memory map instead of learning the model again. Unless key is 0, the key
+ 	* the file was saved with must match. Throws std::runtime_error if the file is missing, corrupt, for another key
+ 	* or was written on a machine with another byte order.
+	*/
+	static std::shared_ptr<const WFCModel> load(std::string filename, uint64_t key = 0);
+	/*
+ 	* Loads the model of input map filename from cache_dir if it has been compiled before, and otherwise learns it
+ 	* and saves it there (as <cache_key in hex>.wfcc). Workers started from the same sample only learn it once.
+	*/
+	static std::shared_ptr<const WFCModel> cached(std::string filename, std::string cache_dir, ModelOptions options = ModelOptions());
+	/*
+ 	* Content hash of the bytes of input map filename and options: the key of its compiled model
+	*/
+	static uint64_t cache_key(std::string filename, ModelOptions options = ModelOptions());
 	/*
  	* Print functions used for debugging
 	*/	
@@ -132,7 +445,100 @@ public:
 	void print_types() const;
 	void print_freqs() const;
 	void print_neigs() const;
-	void print_wave_function(size_t dim_x,size_t dim_y) const;
+	/*
+ 	* Returns the probabilities (one per pattern) of the neighbour in direction neig_i (0-7, clock-wise from W) of pattern type_idx.
+ 	* Only learned in LearningMode::adjacent, where the patterns are the tile types.
+	*/
+	const double* neig_prob(unsigned int type_idx, unsigned int neig_i) const { return &neig_probs[(type_idx*8 + neig_i)*neig_stride]; }
+	/*
+ 	* log2 of neig_prob(type_idx,neig_i) (WaveFunction::log_zero for zero probabilities)
+	*/
+	const double* log_neig_prob(unsigned int type_idx, unsigned int neig_i) const { return &log_neig_probs[(type_idx*8 + neig_i)*neig_stride]; }
+	/*
+ 	* neig_prob and log_neig_prob of type_idx and neig_i as rows of double, or of float (rounded copies of the double
+ 	* rows, for WeightPrecision::float32)
+	*/
+	void neig_rows(unsigned int type_idx, unsigned int neig_i, const double*& probs, const double*& log_probs) const
+	{
+		probs = neig_prob(type_idx,neig_i);
+		log_probs = log_neig_prob(type_idx,neig_i);
+	}
+	void neig_rows(unsigned int type_idx, unsigned int neig_i, const float*& probs, const float*& log_probs) const
+	{
+		probs = &neig_probs_float[(type_idx*8 + neig_i)*neig_stride_float];
+		log_probs = &log_neig_probs_float[(type_idx*8 + neig_i)*neig_stride_float];
+	}
+	/*
+ 	* Returns the bitset (get_adjacency_words() words) of patterns that may be the neighbour in direction neig_i of pattern type_idx.
+ 	* Symmetric: a may be west of b if and only if b may be east of a. In LearningMode::adjacent derived from the non-zero
+ 	* entries of neig_probs.
+	*/
+	const uint64_t* adjacency_mask(unsigned int type_idx, unsigned int neig_i) const { return &adjacency[(type_idx*8 + neig_i)*adjacency_words]; }
+	/*
+ 	* The same patterns as adjacency_mask as a list (ascending). Cheaper to walk than the bitset when it is short.
+	*/
+	const unsigned int* compatible_begin(unsigned int type_idx, unsigned int neig_i) const { return compatible.data() + compatible_offsets[type_idx*8 + neig_i]; }
+	const unsigned int* compatible_end(unsigned int type_idx, unsigned int neig_i) const { return compatible.data() + compatible_offsets[type_idx*8 + neig_i + 1]; }
+	/*
+ 	* Bitset (get_adjacency_words() words) of the patterns whose tile is tile (e.g. for fixing a cell to a tile)
+	*/
+	const uint64_t* tile_mask(tile_id tile) const { return &tile_masks[tile*adjacency_words]; }
+	const std::vector<std::string>& get_types() const { return tile_types; }
+	/*
+ 	* Frequency of each tile type in the input sample
+	*/
+	const std::vector<double>& get_freqs() const { return freq_vector; }
+	size_t get_n_types() const { return tile_types.size(); }
+	/*
+ 	* Frequency of each pattern in the input sample. The same as get_freqs() in LearningMode::adjacent.
+	*/
+	const std::vector<double>& get_weights() const { return model_options.learning == LearningMode::adjacent ? freq_vector : pattern_weights; }
+	size_t get_n_patterns() const { return get_weights().size(); }
+	/*
+ 	* Tile of a cell that holds pattern type_idx
+	*/
+	tile_id tile_of(unsigned int type_idx) const { return model_options.learning == LearningMode::adjacent ? type_idx : pattern_tiles[type_idx]; }
+	const ModelOptions& get_model_options() const { return model_options; }
+	/*
+ 	* Bit neig_i is set if propagation has to look at the neighbour in direction neig_i. In LearningMode::overlapping
+ 	* only W, N, E and S: agreeing with the orthogonal neighbours implies agreeing with the diagonal ones.
+	*/
+	uint8_t get_propagation_directions() const { return model_options.learning == LearningMode::adjacent ? 0xFF : 0x55; }
+	size_t get_adjacency_words() const { return adjacency_words; }
+	const StringMap& get_input() const { return input_sample; }
+	/*
+ 	* 64 bit FNV-1a hash of the input sample (tile names, dimensions and tiles) and, for LearningMode::overlapping,
+ 	* the ModelOptions. Equal hashes mean equal models,
+ 	* so (get_hash(), dim_x, dim_y, seed) identifies a generated map.
+	*/
+	uint64_t get_hash() const { return model_hash; }
+	/*
+ 	* Calculates indices of all 8 neighbours of index idx from 1D vector, which represents a dim_x*dim_y 2D surface,
+ 	* and writes them to indices[0..7]. Neighbours that don't exist are set to -1 (out of bounds).
+ 	* Meant for single lookups; loops over many cells should use Grid, which does the same with precomputed tables.
+	*/
+	static void get_neighbours(unsigned int idx, size_t dim_x, size_t dim_y, unsigned int* indices);
+	// TODO: Remove print_vector and move to utils
+	static void print_vector(std::vector<double> v)
+	{
+		print_vector(v.data(),v.size());
+	}
+	template <typename Real> static void print_vector(const Real* v, size_t n)
+	{
+		print_vector(std::cout,v,n);
+	}
+	template <typename Real> static void print_vector(std::ostream& os, const Real* v, size_t n)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			os << v[i] << ",";
+		}
+	}
+private:
+	/*
+ 	* Empty model, filled by load
+	*/
+	WFCModel() : input_sample(0,0) , neig_stride(0) , neig_stride_float(0) , adjacency_words(0) , model_hash(0) {}
 	/*
  	* Calculates neigs based on input_sample
 	*/	
@@ -140,59 +546,411 @@ public:
 	/*
  	* One update step (counting sums) that is performed on each coordinate of input_sample in order to calculate neig_probs
 	*/
-	void neigs_rotation_increment(unsigned int idx);
+	void neigs_rotation_increment(unsigned int idx, const Grid& grid);
+	double* neig_prob(unsigned int type_idx, unsigned int neig_i) { return &neig_probs[(type_idx*8 + neig_i)*neig_stride]; }
 	/*
  	* Transforms counted sums (in neig_probs) into probabilities for each tile_type for each neighbour.
 	*/
 	void neigs_normalize();
 	/*
- 	* Generate StringMap with dimensions dim_x*dim_y
+ 	* Fills neig_probs_float and log_neig_probs_float from neig_probs
+	*/
+	void calculate_neigs_float();
+	/*
+ 	* Derives the adjacency bitsets used by propagation from the non-zero entries of neig_probs.
+	*/
+	void calculate_adjacency();
+	/*
+ 	* LearningMode::overlapping: extracts the patterns and fills pattern_weights, pattern_tiles and the adjacency bitsets
+	*/
+	void calculate_patterns();
+	/*
+ 	* Fills compatible from the adjacency bitsets and tile_masks from tile_of
+	*/
+	void calculate_compatible();
+	/*
+ 	* Hashes input_sample byte by byte (integers little endian), so the hash is the same on every platform
+	*/
+	uint64_t calculate_hash() const;
+
+	std::string m_filename;
+	StringMap input_sample;
+	std::vector<double> freq_vector;
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> neig_probs; // Dense [type][direction][type] tensor, rows padded to neig_stride
+	std::vector<double, AlignedAllocator<double,WaveFunction::alignment>> log_neig_probs; // log2 of neig_probs
+	size_t neig_stride;
+	std::vector<float, AlignedAllocator<float,WaveFunction::alignment>> neig_probs_float; // neig_probs rounded to float, rows padded to neig_stride_float. Not saved.
+	std::vector<float, AlignedAllocator<float,WaveFunction::alignment>> log_neig_probs_float; // log2 of neig_probs_float
+	size_t neig_stride_float;
+	std::vector<uint64_t> adjacency; // [type][direction][word] bitsets of allowed neighbour types
+	size_t adjacency_words; // Words per bitset
+	std::vector<unsigned int> compatible; // adjacency as lists, [type][direction] starts at compatible_offsets[type*8 + direction]
+	std::vector<size_t> compatible_offsets;
+	std::vector<uint64_t> tile_masks; // [tile][word] bitsets of the patterns of each tile
+	std::vector<std::string> tile_types; // tile id -> tile name
+	ModelOptions model_options;
+	std::vector<double> pattern_weights; // LearningMode::overlapping: frequency of each pattern
+	std::vector<tile_id> pattern_tiles; // LearningMode::overlapping: top left tile of each pattern
+	uint64_t model_hash;
+};
+
+/*
+* Generation state of one map: wave function, domains, queue and propagation scratch space.
+* Reads a shared WFCModel and owns everything it writes, so different solvers can run on different threads.
+* Buffers are reused by consecutive generate_map calls.
+*/
+class WFCSolver
+{
+public:
+	/*
+ 	* options.mode selects the solver (see SolverMode), options.contradiction the contradiction handling.
+	*/
+	WFCSolver(std::shared_ptr<const WFCModel> model, WFCOptions options = WFCOptions());
+	void print_wave_function(size_t dim_x) const;
+	const WFCModel& get_model() const { return *model; }
+	std::shared_ptr<const WFCModel> get_shared_model() const { return model; }
+	const WFCOptions& get_options() const { return options; }
+	SolverMode get_mode() const { return options.mode; }
+	/*
+ 	* Propagation counters of the last generate_map call
+	*/
+	const PropagationStats& get_propagation_stats() const { return stats; }
+	/*
+ 	* Statistics of the last generate_map call (timings only if built with WFC_PROFILE)
+	*/
+	GenerationStats get_generation_stats() const;
+	/*
+ 	* Generate StringMap with dimensions dim_x*dim_y. The seed is taken from the system clock (see get_seed).
 	*/	
 	StringMap generate_map(size_t dim_x, size_t dim_y);
+	/*
+ 	* Generate StringMap with dimensions dim_x*dim_y from given seed. The same model, options, dimensions and seed
+ 	* always give the same map, on every platform (the random numbers come from Xoshiro256).
+	*/	
+	StringMap generate_map(size_t dim_x, size_t dim_y, uint64_t seed);
+	/*
+ 	* Same as above, but with given tiles: fixed (dim_x*dim_y tile ids, or empty for none) holds the tile of every cell
+ 	* that must not be generated, and free_cell for the others. The given tiles are collapsed before any other cell,
+ 	* so the generated cells fit to them (e.g. to the border of a neighbouring chunk).
+	*/
+	StringMap generate_map(size_t dim_x, size_t dim_y, uint64_t seed, const std::vector<tile_id>& fixed);
+	/*
+ 	* Same as generate_map, but writes the map to out (see StringMap::reset). The solver sizes its buffers on the first
+ 	* call and reuses them, so repeated calls with the same dimensions and the same out do not allocate.
+	*/
+	void generate_map_into(StringMap& out, size_t dim_x, size_t dim_y, uint64_t seed);
+	void generate_map_into(StringMap& out, size_t dim_x, size_t dim_y, uint64_t seed, const std::vector<tile_id>& fixed);
+	/*
+ 	* generate_map in steps, e.g. spread over several frames: begin_map starts a map (same parameters as generate_map),
+ 	* every step_map call goes on with it until budget has passed or max_collapses cells are set and returns true
+ 	* once the map is complete, and finish_map writes it to out. The map is the same as from generate_map.
+ 	*	wfc.begin_map(256,256,seed);
+ 	*	while(!wfc.step_map(std::chrono::milliseconds(4))) { render(); }
+ 	*	wfc.finish_map(map);
+ 	* The time is checked every few collapses, and every call sets at least one cell. A single collapse can take much
+ 	* longer than the budget if it propagates far or backtracks.
+	*/
+	void begin_map(size_t dim_x, size_t dim_y, uint64_t seed, const std::vector<tile_id>& fixed = std::vector<tile_id>());
+	bool step_map(std::chrono::nanoseconds budget, size_t max_collapses = std::numeric_limits<size_t>::max());
+	void finish_map(StringMap& out);
+	bool map_finished() const { return map_done; }
+	/*
+ 	* Cells set in the current attempt of the current map, and the attempt (increased by every restart)
+	*/
+	size_t collapsed_cells() const;
+	unsigned int get_attempt() const { return attempt; }
+	/*
+ 	* With enabled, every collapse is logged as a CellUpdate until take_collapsed moves the log to cells. A restart
+ 	* clears the log. Off by default.
+	*/
+	void log_collapses(bool enabled) { logging = enabled; }
+	void take_collapsed(std::vector<CellUpdate>& cells) { cells.clear(); cells.swap(collapse_log); }
+	static const tile_id free_cell = std::numeric_limits<tile_id>::max(); // Marks a cell of generate_map's fixed that is generated
+	/*
+ 	* Generates the cells of map inside the rectangle of width x height cells at (x0,y0) again, in place, e.g. to reroll
+ 	* an area of an edited map. The cells around the rectangle keep their tiles and constrain the new ones, so the result
+ 	* fits in seamlessly. Only the rectangle and a border of one cell (pattern_size - 1 for the overlapping model) are
+ 	* solved, so the cost depends on the size of the rectangle, not of the map. Tiles are matched to the model by name;
+ 	* a tile in the border that the model does not know throws std::invalid_argument. With options.wrap, the border
+ 	* wraps around the map edges, and the rectangle plus border must fit into the map.
+	*/
+	void regenerate(StringMap& map, size_t x0, size_t y0, size_t width, size_t height, uint64_t seed);
+	/*
+ 	* Same as above, but only the cells of the rectangle whose entry in mask (width*height, row by row) is non-zero are
+ 	* generated again; the others constrain them like the border.
+	*/
+	void regenerate(StringMap& map, size_t x0, size_t y0, size_t width, size_t height, uint64_t seed, const std::vector<uint8_t>& mask);
+	/*
+ 	* Seed of the last generate_map call, e.g. for reproducing a map that was generated with a clock seed
+	*/
+	uint64_t get_seed() const { return seed; }
 	
-	double shannon_entropy(std::vector<double>) const;
 	/*
- 	* Gets index among vector of probabilities (probs) that represents given double value (type)
+ 	* Shannon entropy of n_types probabilities starting at probs (computed with a fast, vectorized log2)
 	*/	
-	int get_type_idx(std::vector<double> probs, double type) const;
+	double shannon_entropy(const double* probs, size_t n_types) const;
 	/*
- 	* Sets tile type on *probs_ptr (second of queue) to type_idx (i.e. *probs_ptr[type_idx] = 1, rest to 0). Also updates wave_function of neighbours
+ 	* Gets index among n_types weights (probs, double or float) that represents given double value (type). type must be in [0,sum of probs).
 	*/	
-	void set_tile_type(unsigned int idx,unsigned int type_idx);
+	template <typename Real> int get_type_idx(const Real* probs, size_t n_types, double type) const;
+	/*
+ 	* Chooses a tile type for cell wave_idx, weighted by its current weights. type is a random number in [0,1).
+	*/	
+	unsigned int choose_type(unsigned int wave_idx, double type) const;
+	/*
+ 	* Sets cell wave_idx to tile type type_idx and updates the cells around it (update_wave_neigs and propagate).
+ 	* Returns false if a contradiction occured that was not repaired (see ContradictionPolicy).
+	*/	
+	bool collapse_cell(unsigned int wave_idx, unsigned int type_idx);
 	/*
- 	* Calculates indices of all 8 neighbours (all neighbours that don't exist are out of bounds) of index idx from 1D vector, which represents a dim_x*dim_y 2D surface
+ 	* Sets tile type on *probs_ptr (second of queue) (i.e. *probs_ptr[type_idx] = 1, rest to 0). Also updates wave_function of neighbours
 	*/	
-	std::vector<unsigned int> get_neighbours(unsigned int idx, size_t dim_x, size_t dim_y);
+	void set_tile_type(unsigned int idx,unsigned int type_idx);
 	/*
  	* Updates wave_function of neighbours based on neig_probs[idx].second[type_idx]. Also takes care of updating the queue. 
+ 	* Neighbours that have already been collapsed (i.e. are no longer in the queue) are left untouched.
 	*/		
-	void update_wave_neigs(unsigned int idx,unsigned int type_idx,size_t dim_x, size_t dim_y);
+	bool update_wave_neigs(unsigned int idx,unsigned int type_idx);
 	/*
- 	* Performs dot product of two vectors (of same size) and normalizes the result. Returns this normalized product.
+ 	* update_wave_neigs on the wave function of one precision (weights is wave_function or wave_function_float)
+	*/
+	template <typename Real> bool update_wave_neigs(BasicWaveFunction<Real>& weights, unsigned int idx, unsigned int type_idx);
+	/*
+ 	* Multiplies the weights of wave_function[wave_idx] elementwise with probs1 (log_probs1 holds log2 of probs1)
+ 	* and updates the running entropy sums of the cell. The weights are not renormalized; the entropy
+ 	* and get_type_idx only depend on their ratios. On contradiction, sets the cell to uniform weights if
+ 	* contradictions are repaired and returns false otherwise. The first form needs WeightPrecision::float64.
 	*/		
-	std::vector<double> dot_and_normalize(std::vector<double> probs1, std::vector<double> probs2) const;
+	bool multiply_wave(unsigned int wave_idx, const double* probs1, const double* log_probs1);
+	template <typename Real> bool multiply_wave(BasicWaveFunction<Real>& weights, unsigned int wave_idx, const Real* probs1, const Real* log_probs1);
+	/*
+ 	* Pops cells from the worklist until it is empty. For every popped cell, removes the types that are not supported
+ 	* by its domain from the domains (and, in probabilistic mode, the weights) of its uncollapsed neighbours, and pushes
+ 	* every neighbour that changed. Updates the queue and the propagation counters.
+ 	* A change that would leave a domain empty (contradiction) is not applied. If contradictions are not repaired,
+ 	* the worklist is emptied and false is returned.
+	*/
+	bool propagate();
+	/*
+ 	* propagate for domains of Words words, so that every loop over a bitset has a fixed trip count and unrolls
+ 	* (Words == 1 holds up to 64 patterns, which covers the maps in Maps/). Words == 0 reads the count from domains at
+ 	* run time. propagate picks the instantiation, the results are the same for all of them.
+	*/
+	template <size_t Words> bool propagate_words();
+	/*
+ 	* Sets allowed to the types that may be the neighbour in direction neig_i of some type of cell cur. Only the bits
+ 	* of the domain of neighbour neig are exact; depending on the domain sizes the types of cur are walked (forward)
+ 	* or a supporting type in cur is searched for every type of neig (backward).
+	*/
+	template <size_t Words> void collect_support(unsigned int cur, unsigned int neig_i, unsigned int neig);
+	/*
+ 	* Whether cell wave_idx keeps a possible type if it is restricted to allowed (in probabilistic mode the type
+ 	* must have non-zero weight as well)
+	*/
+	bool has_support(unsigned int wave_idx, const uint64_t* allowed) const;
+	template <size_t Words> bool has_support(unsigned int wave_idx, const uint64_t* allowed) const;
+	/*
+ 	* Saves cell wave_idx to the trail before it is changed (no-op unless backtracking)
+	*/
+	void save_cell(unsigned int wave_idx)
+	{
+		if(!backtracking) { return; }
+		if(options.mode == SolverMode::bitset) { trail.save(wave_idx,domains,(const WaveFunction*)nullptr); }
+		else if(options.precision == WeightPrecision::float32) { trail.save(wave_idx,domains,&wave_function_float); }
+		else { trail.save(wave_idx,domains,&wave_function); }
+	}
+	/*
+ 	* Removes the types that are not in allowed (domains.words() words) from cell wave_idx, from its weights as well in
+ 	* probabilistic mode, and updates its entropy in the queue. Returns the number of removed types.
+	*/
+	size_t restrict_cell(unsigned int wave_idx, const uint64_t* allowed);
+	template <size_t Words> size_t restrict_cell(unsigned int wave_idx, const uint64_t* allowed);
+	/*
+ 	* Probabilistic part of restrict_cell: bans the types of the domain of wave_idx that are not in allowed from the
+ 	* domain and from weights. Returns the number of banned types.
+	*/
+	template <size_t Words, typename Real> size_t ban_types(BasicWaveFunction<Real>& weights, unsigned int wave_idx, const uint64_t* allowed);
+	/*
+ 	* Entropy of cell wave_idx in the current mode
+	*/
+	double cell_entropy(unsigned int wave_idx) const
+	{
+		if(options.mode == SolverMode::bitset) { return domains.entropy(wave_idx); }
+		return options.precision == WeightPrecision::float32 ? wave_function_float.entropy(wave_idx) : wave_function.entropy(wave_idx);
+	}
+	/*
+ 	* Whether type_idx has non-zero weight in cell wave_idx (SolverMode::probabilistic)
+	*/
+	bool has_weight(unsigned int wave_idx, size_t type_idx) const
+	{
+		return options.precision == WeightPrecision::float32 ? wave_function_float[wave_idx][type_idx] > 0 : wave_function[wave_idx][type_idx] > 0;
+	}
 	/*
  	* Creates StringMap based on WaveFunction values and returns it
 	*/		
 	StringMap create_stringMap(size_t dim_x, size_t dim_y) const;
-	// TODO: Remove print_vector and move to utils + implement Template version
-	void print_vector(std::vector<double> v) const
+	/*
+ 	* Same as above, written to sm (see StringMap::reset)
+	*/
+	void create_stringMap(StringMap& sm, size_t dim_x, size_t dim_y) const;
+
+private:
+	struct Decision
 	{
-		for(double v_i : v)
+		unsigned int cell;
+		unsigned int type_idx;
+		size_t trail_mark; // trail.size() before the cell was collapsed
+		Decision(unsigned int cell, unsigned int type_idx, size_t trail_mark) : cell(cell), type_idx(type_idx), trail_mark(trail_mark) {}
+	};
+	enum class AttemptState { running, solved, failed };
+	/*
+ 	* Limits of one step_map call
+	*/
+	struct StepBudget
+	{
+		std::chrono::steady_clock::time_point deadline;
+		bool timed; // Whether deadline applies
+		size_t collapses_left;
+		unsigned int until_check; // Collapses until the clock is read again
+		/*
+ 		* Called after every collapse. Whether the step has to return.
+		*/
+		bool spent()
 		{
-			std::cout << v_i << ",";
+			if(--collapses_left == 0) { return true; }
+			if(!timed || --until_check > 0) { return false; }
+			until_check = 16;
+			return std::chrono::steady_clock::now() >= deadline;
 		}
-	}
+	};
+	/*
+ 	* Starts an attempt of the current map: initializes the cells and collapses the fixed cells (see generate_map).
+ 	* Returns false if the attempt has to be restarted.
+	*/
+	bool start_attempt();
+	/*
+ 	* Collapses the remaining cells of the attempt until budget is spent
+	*/
+	AttemptState advance_attempt(StepBudget& budget);
+	/*
+ 	* Undoes decisions until banning the type of the undone decision from its cell propagates without contradiction.
+ 	* Returns false if there are no decisions left or max_backtracks is reached.
+	*/
+	bool backtrack();
+	/*
+ 	* start_attempt and advance_attempt of CollapseOrder::scanline and hilbert: set the cells of scan_types one by
+ 	* one in that order
+	*/
+	bool start_scanline();
+	AttemptState advance_scanline(StepBudget& budget);
+	/*
+ 	* Samples the type of cell wave_idx (type in [0,1)) from the model weights conditioned on its neighbours in
+ 	* directions (bit mask, see Grid) that are already set in scan_types. Returns get_n_patterns() if no type is left.
+	*/
+	unsigned int sample_scan_cell(unsigned int wave_idx, uint8_t directions, double type);
+
+	std::shared_ptr<const WFCModel> model;
+	WFCOptions options;
+	const SimdKernels* kernels; // Probability kernels for the running CPU (see simd.hpp)
+	uint64_t seed; // Of the last generate_map call
+	WaveFunction wave_function; // SolverMode::probabilistic: dim_x*dim_y rows of probabilities (one per tile type) in one contiguous buffer
+	WaveFunctionFloat wave_function_float; // Instead of wave_function with WeightPrecision::float32
+	Domains domains; // dim_x*dim_y bitsets of allowed tile types (both modes)
+	Grid grid; // Neighbour offsets of the map being generated
+	Worklist worklist; // Cells whose domain changed and still have to be propagated
+	std::vector<uint64_t> allowed; // Scratch bitset for propagate
+	PropagationStats stats;
+#ifdef WFC_PROFILE
+	Profiler profiler; // Not even a member without WFC_PROFILE
+#endif
+	size_t last_dim_x; // Of the last generate_map call
+	size_t last_dim_y;
+	Xoshiro256 rng; // Of the current map. A restarted attempt goes on with the next numbers, i.e. a new random sequence.
+	std::vector<tile_id> fixed_cells; // Of the current map (see generate_map)
+	unsigned int attempt; // Of the current map
+	bool attempt_started;
+	bool map_done;
+	unsigned int n_random; // Cells of the current attempt collapsed at random positions so far
+	unsigned int first_n; // Cells to collapse at random positions before following the entropy
+	size_t scan_pos; // Position of the next cell in CollapseOrder::scanline or hilbert
+	size_t scan_side; // CollapseOrder::hilbert: side of the power of two square covered by the curve
+	size_t scan_set; // Cells set in the current scanline or hilbert attempt
+	bool logging; // Whether collapses are logged (see log_collapses)
+	std::vector<CellUpdate> collapse_log;
+	bool repair_contradictions; // Whether the current attempt patches contradictions in place
+	bool backtracking; // Whether the current attempt records the trail
+	size_t attempt_backtracks; // Backtracks in the current attempt
+	Trail trail; // Undo log of the cells changed since the oldest decision that can still be undone
+	std::vector<Decision> decisions; // Collapses that can be undone, oldest first
+	std::vector<unsigned int> restored; // Scratch list of cells restored by trail.undo
+	EntropyQueue queue; // Cells that have not been collapsed yet, ordered by shannon entropy
+	std::vector<unsigned int> scan_types; // CollapseOrder::scanline and hilbert: pattern of every cell, get_n_patterns() while not set
+	std::vector<double> scan_weights; // Scratch for sample_scan_cell: conditioned weight of every pattern
+};
 
+/*
+* Learns a WFCModel from an input map and generates maps from it, either one at a time (WFCSolver::generate_map)
+* or many at once on a thread pool (generate_batch). Every pool thread has its own WFCSolver sharing the model.
+*/
+class WFC : public WFCSolver
+{
+public:
+	/*
+ 	* Constructor
+ 	* Takes filename of input map (same file format as StringMap and TileMap uses) as parameter.
+ 	* Initializes internal variables based on input map.
+ 	* options.mode selects the solver (see SolverMode), model_options what is learned (see LearningMode).
+	*/		
+	WFC(std::string filename, WFCOptions options = WFCOptions(), ModelOptions model_options = ModelOptions());
+	/*
+ 	* Generates maps from a model that has been learned or loaded already (e.g. WFCModel::cached)
+	*/
+	WFC(std::shared_ptr<const WFCModel> model, WFCOptions options = WFCOptions());
+	/*
+ 	* Print functions used for debugging
+	*/	
+	void print_input() const { get_model().print_input(); }
+	void print_types() const { get_model().print_types(); }
+	void print_freqs() const { get_model().print_freqs(); }
+	void print_neigs() const { get_model().print_neigs(); }
+	const double* neig_prob(unsigned int type_idx, unsigned int neig_i) const { return get_model().neig_prob(type_idx,neig_i); }
+	const double* log_neig_prob(unsigned int type_idx, unsigned int neig_i) const { return get_model().log_neig_prob(type_idx,neig_i); }
+	const uint64_t* adjacency_mask(unsigned int type_idx, unsigned int neig_i) const { return get_model().adjacency_mask(type_idx,neig_i); }
+	/*
+ 	* Generates n maps with dimensions dim_x*dim_y on a work-stealing thread pool of n_threads threads
+ 	* (0: one per hardware thread). Map i is generated from seeds[i]; if seeds is empty, the seeds are derived from
+ 	* the system clock. The pool and its solvers are kept for the next call.
+ 	* Map i only depends on its seed, so the output is identical for every thread count.
+	*/
+	std::vector<StringMap> generate_batch(size_t n, size_t dim_x, size_t dim_y, const std::vector<uint64_t>& seeds = std::vector<uint64_t>(), size_t n_threads = 0);
+	/*
+ 	* Same as above, map i is generated from Xoshiro256::split(seed,i)
+	*/
+	std::vector<StringMap> generate_batch(size_t n, size_t dim_x, size_t dim_y, uint64_t seed, size_t n_threads = 0);
+	/*
+ 	* Generates one map with dimensions dim_x*dim_y on n_threads threads (0: one per hardware thread). The map is
+ 	* split into regions of region_size x region_size cells whose borders are generated first and independently
+ 	* (see SeamLattice), so all regions can then be solved concurrently and still fit together. region_size >= 4.
+ 	* The map only depends on seed and region_size, not on the number of threads.
+	*/
+	StringMap generate_map_parallel(size_t dim_x, size_t dim_y, uint64_t seed, size_t region_size = 256, size_t n_threads = 0);
+	/*
+ 	* Starts generating a map on a thread of its own and returns at once. The map is the same as from generate_map with
+ 	* the same seed. The progress callback gets the newly set cells in batches, so the map can be drawn while it is
+ 	* generated. Cancelling (the handle or async_options.cancel) or dropping the handle stops the generation within
+ 	* about a millisecond (step_map), and the future throws generation_cancelled. Setting up a map of millions of
+ 	* cells in entropy order takes a few hundred milliseconds and is not interrupted. The generation has its own
+ 	* WFCSolver sharing the model, so this WFC can be used meanwhile.
+	*/
+	GenerationHandle generate_async(size_t dim_x, size_t dim_y, uint64_t seed, AsyncOptions async_options = AsyncOptions());
 private:
-	std::string m_filename;
-	StringMap input_sample;
-	std::vector<double> freq_vector;
-	std::map<std::string, std::vector<std::vector<double>>> neig_probs;
-	std::vector<std::vector<double>> wave_function;
-	std::vector<std::pair<double,unsigned int>> queue; //first: shannon entropy, second: index to wave_function
-	std::map<std::string,int> tile_type_map;
-	std::vector<std::string> tile_types;
+	/*
+ 	* Makes sure pool has n_threads threads (0: one per hardware thread) and there is one solver per thread
+	*/
+	void prepare_pool(size_t n_threads);
+
+	std::unique_ptr<ThreadPool> pool;
+	std::vector<std::unique_ptr<WFCSolver>> solvers; // One per pool thread
 };
 
 void test_wfc(std::string input_map,size_t dim_x, size_t dim_y, int n); // prints out n randomly generated maps Based on input_map 
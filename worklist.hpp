@@ -0,0 +1,59 @@
+#ifndef STRATEGY_WORKLIST_H
+#define STRATEGY_WORKLIST_H
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+
+/*
+Worklist
+	Description
+		Bounded LIFO stack of cells used by WFC::propagate. Storage for every cell is allocated once by
+		reset(), and a cell is never on the stack twice (push is a no-op for queued cells), so the
+		stack can never hold more than n_cells entries and push/pop never allocate.
+*/
+class Worklist
+{
+public:
+	Worklist() : top(0) {}
+	/*
+	* Empties the worklist and makes room for n_cells cells
+	*/
+	void reset(size_t n_cells)
+	{
+		stack.resize(n_cells);
+		queued.assign((n_cells + 63)/64,0);
+		top = 0;
+	}
+	/*
+	* Pushes cell unless it is already on the worklist
+	*/
+	void push(unsigned int cell)
+	{
+		uint64_t bit = (uint64_t)1 << (cell%64);
+		if(queued[cell/64] & bit) { return; }
+		if(top >= stack.size()) { throw std::out_of_range("Worklist::push: more cells than reserved. Bug in code?"); }
+		queued[cell/64] |= bit;
+		stack[top++] = cell;
+	}
+	unsigned int pop()
+	{
+		unsigned int cell = stack[--top];
+		queued[cell/64] &= ~((uint64_t)1 << (cell%64));
+		return cell;
+	}
+	/*
+	* Drops all queued cells
+	*/
+	void clear()
+	{
+		while(top > 0) { pop(); }
+	}
+	bool empty() const { return top == 0; }
+	size_t size() const { return top; }
+private:
+	std::vector<unsigned int> stack;
+	std::vector<uint64_t> queued; // One bit per cell: is the cell on the stack
+	size_t top;
+};
+
+#endif